@@ -11,19 +11,112 @@
 #include <string.h>
 #include <limits.h>
 #include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <pthread.h>
 #include "allocator.h"
 #include "segment.h"
 
 // Heap blocks are required to be aligned to 8-byte boundary
 #define ALIGNMENT 8
-#define SIZE_MASK 0x7ffffffc
+#define SIZE_MASK 0x7ffffff8
 #define FREE_MASK 0x80000000
 #define PREV_FREE 0x00000001
 #define NEXT_FREE 0x00000002
+#define HANDLE_BLOCK 0x00000004 // block belongs to a handle and may be moved
 #define INIT_MASK 0xfffffffe
-#define NUM_BUCKETS 15
 #define INT_BITS 32
-#define INIT_PAGES 1 
+// largest request whose size still fits the header
+#define MAX_REQUEST (SIZE_MASK - PAGE_SIZE)
+
+// Policy parameters, each can be overridden with -D when compiling so
+// that the compiler specializes the allocator for one policy. A whole set
+// of them (such as the one written by tune) can be given as a header
+// with -DPOLICY_HEADER='"file.h"'
+#ifdef POLICY_HEADER
+#include POLICY_HEADER
+#endif
+#ifndef NUM_BUCKETS
+#define NUM_BUCKETS 15 // number of segregated lists
+#endif
+#ifndef BUCKET_BASE_BITS
+#define BUCKET_BASE_BITS 3 // sizes of 1 << BUCKET_BASE_BITS bits go in bucket 0
+#endif
+#ifndef BUCKET_SPLIT_BITS
+#define BUCKET_SPLIT_BITS 0 // each power of 2 is split over 1 << BUCKET_SPLIT_BITS buckets
+#endif
+#ifndef MIN_PAYLOAD
+#define MIN_PAYLOAD 16 // smallest payload handed out, must fit the list pointers
+#endif
+#ifndef INIT_PAGES
+#define INIT_PAGES 1 // pages in a fresh heap
+#endif
+#ifndef EXTEND_PAGES
+#define EXTEND_PAGES 1 // fewest pages the heap grows by at a time
+#endif
+#ifndef SPLIT_MIN
+#define SPLIT_MIN 8 // smallest leftover, header included, split off a block
+#endif
+#ifndef MAX_ROOTS
+#define MAX_ROOTS 64 // most root ranges the collector of a heap scans
+#endif
+#ifndef PAYLOAD_ALIGNMENT
+#define PAYLOAD_ALIGNMENT ALIGNMENT // every payload starts on a multiple of this
+#endif
+#ifndef SORTED_LISTS
+#define SORTED_LISTS 1 // 1 keeps lists sorted by size, 0 pushes freed blocks in front
+#endif
+#ifndef BEST_FIT
+#define BEST_FIT 1 // 1 takes the smallest fit in a bucket, 0 takes the first fit
+#endif
+
+// With QUICK_LISTS freed blocks with payloads up to QUICK_MAX bytes are
+// not coalesced right away but kept, still marked in use, on a LIFO list
+// per size. A request of the same size pops one back off. Once more than
+// QUICK_LIMIT blocks are held, or before the heap has to grow, the quick
+// lists are swept, which frees and coalesces their blocks for real. A
+// sweep during a call handles at most SWEEP_STEP blocks, so that no single
+// call pays for all of them, myheap_maintain sweeps the rest when idle.
+#ifndef QUICK_MAX
+#define QUICK_MAX 256 // largest payload kept on a quick list
+#endif
+#ifndef QUICK_LIMIT
+#define QUICK_LIMIT 1024 // blocks held on the quick lists before a sweep
+#endif
+#ifndef SWEEP_STEP
+#define SWEEP_STEP 16 // most blocks swept by one malloc or free
+#endif
+#define NUM_QUICK ((QUICK_MAX - MIN_PAYLOAD)/ALIGNMENT + 1)
+
+#if PAYLOAD_ALIGNMENT < ALIGNMENT || (PAYLOAD_ALIGNMENT & (PAYLOAD_ALIGNMENT-1)) != 0 || PAYLOAD_ALIGNMENT > 64
+#error "PAYLOAD_ALIGNMENT must be a power of 2 from ALIGNMENT to 64"
+#endif
+#if NUM_BUCKETS < 3
+#error "NUM_BUCKETS must be at least 3, sizes below 16 have no bucket"
+#endif
+#if MIN_PAYLOAD < 16 || MIN_PAYLOAD % ALIGNMENT != 0
+#error "MIN_PAYLOAD must be a multiple of ALIGNMENT that fits two pointers"
+#endif
+#if INIT_PAGES < 1 || EXTEND_PAGES < 1
+#error "INIT_PAGES and EXTEND_PAGES must be at least 1"
+#endif
+#if BUCKET_BASE_BITS > 5 || BUCKET_SPLIT_BITS > 4
+#error "BUCKET_BASE_BITS must be at most 5 and BUCKET_SPLIT_BITS at most 4"
+#endif
+#if SPLIT_MIN < 8 || SPLIT_MIN % ALIGNMENT != 0
+#error "SPLIT_MIN must be a multiple of ALIGNMENT that fits a header"
+#endif
+#if SWEEP_STEP < 1
+#error "SWEEP_STEP must be at least 1"
+#endif
+#if QUICK_MAX < MIN_PAYLOAD || QUICK_MAX % ALIGNMENT != 0
+#error "QUICK_MAX must be a multiple of ALIGNMENT no smaller than MIN_PAYLOAD"
+#endif
 
 #pragma pack(1)
 
@@ -31,11 +124,83 @@ typedef struct {
    unsigned int payloadsz;
    unsigned int prevpayloadsz; 
 } headerT;
+#pragma pack()
+
+#ifdef FREE_INDEX
+// With FREE_INDEX the free-lists are not threaded through the free blocks.
+// Each bucket instead keeps a packed array of (offset, size) entries in a
+// side segment, so a fit search scans contiguous memory rather than chasing
+// links into blocks scattered over the heap. A listed block remembers the
+// slot of its entry in the first word of its payload.
+typedef struct {
+   unsigned int offset; // payload offset from the heap start, in ALIGNMENT units
+   unsigned int size;   // payload size, same as in the block header
+} indexT;
+#endif
+
+#ifdef FREE_BITMAP
+// With FREE_BITMAP the free status of every block is also kept in a dense
+// bitmap with one bit per ALIGNMENT bytes of the segment, set when a free
+// block starts there. Neighbour checks become bit lookups, so the NEXT_FREE
+// and PREV_FREE flags are not kept and freeing a block no longer writes to
+// the headers of the blocks around it. Only bits at current block starts
+// are meaningful, bits left inside merged blocks are rewritten before a
+// block can start there again.
+#define WORD_BITS (sizeof(unsigned long)*CHAR_BIT)
+#endif
+
+// All of the state of one heap. The default heap behind mymalloc and the
+// others is a static one over the default segment, a heap made by
+// myheap_create lives at the start of its own segment, ahead of its blocks.
+struct myheap {
+    unsigned long magic; // PERSIST_MAGIC plus the size of this struct in a heap file
+    char *mapped_at; // where a heap file was mapped the last time it was open
+    void *root; // the block a heap file is reopened from
+    bool shared; // mapped by several processes, which take turns through lock
+    pthread_mutex_t lock; // process-shared, robust and recursive
+    segment_t *segment; // the segment the blocks are carved from
+    segment_t own_segment; // the segment of a heap from myheap_create
+    char *heap_base; // first block header, offsets are relative to it
+    void *buckets[NUM_BUCKETS]; // explicit segregated free-lists
+    void *max_block; // pointer to the largest block in the heap
+    void *min_block; // pointer to the smallest block in the heap
+    allocstats_t stats; // free-list work since the heap was emptied
+    myheap_t *long_lived; // heap for blocks hinted to be long-lived, made on first use
+    myheap_t *overflow; // heap in a reservation of its own, made once this one is full
+    struct myhandle *handles; // handle table, reserved on first use
+    struct myhandle *free_handles; // handles given back, to be used again first
+    size_t handles_used; // handles in the table ever handed out
+    struct { void *start; size_t len; } roots[MAX_ROOTS]; // ranges myheap_collect scans
+    int nroots; // root ranges registered
+#ifdef QUICK_LISTS
+    void *quick[NUM_QUICK]; // freed blocks of each small size, not coalesced yet
+    unsigned int quick_count; // blocks held on all of the quick lists
+    unsigned int sweep_next; // quick list the next sweep starts from
+#endif
+#ifdef FREE_INDEX
+    indexT *bucket_index[NUM_BUCKETS]; // entries of the free blocks in each bucket
+    unsigned int bucket_len[NUM_BUCKETS]; // number of entries in use per bucket
+#endif
+#ifdef FREE_BITMAP
+    unsigned long *free_bitmap; // one bit per granule of the segment
+#endif
+};
+
+// the heap used by mymalloc, myrealloc and myfree
+static myheap_t default_heap;
 
-// global variables
-void *buckets[NUM_BUCKETS]; // explicit segregated free-lists
-void *max_block; // pointer to the largest block in the heap
-void *min_block; // pointer to the smallest block in the heap
+// Marks the start of a heap file. The size of the heap state is added in,
+// so that a file made by a build with other policies is not taken for one.
+#define PERSIST_MAGIC 0x6d79686561700000UL
+
+// A block allocated through a handle starts with a pointer back to the
+// handle, the caller's data follows it. Handles are kept in a table in a
+// side segment so they never move, free ones are chained through block.
+struct myhandle {
+    void *block; // payload of the block, or the next free handle
+    unsigned int locks; // the block cannot move while this is not 0
+};
+#define MAX_HANDLES (1L << 24) // most handles a heap can have at once
 
 // Very efficient bitwise round of sz up to nearest multiple of mult
 // does this by adding mult-1 to sz, then masking off the
@@ -47,6 +212,18 @@ static inline size_t roundup(size_t sz, size_t mult)
     return (sz + mult-1) & ~(mult-1);
 }
 
+/**
+ * Rounds a requested size up to the payload of the block that holds it,
+ * at least MIN_PAYLOAD and sized so that the block, header included, is a
+ * multiple of PAYLOAD_ALIGNMENT. Blocks sized this way keep the payloads
+ * of the blocks above them on PAYLOAD_ALIGNMENT.
+ */
+static inline size_t payload_size(size_t requestedsz)
+{
+    if(requestedsz < MIN_PAYLOAD) requestedsz = MIN_PAYLOAD;
+    return roundup(requestedsz + sizeof(headerT), PAYLOAD_ALIGNMENT) - sizeof(headerT);
+}
+
 /** Given a pointer to start of payload, simply back up
   * to access its block header
   */
@@ -107,12 +284,17 @@ static inline unsigned int get_prev_size(void *payload){
 
 /**
  * Given a value of a payload's size , calculates the bucket 
- * to place a payload of that size in the segregated free-ist
+ * to place a payload of that size in the segregated free-ist.
+ * Buckets follow the powers of 2, with BUCKET_SPLIT_BITS more bits
+ * of the size picking one of the buckets a power is split over.
  */
 static inline int cal_bucket(unsigned int value){
-    int bucket = INT_BITS -__builtin_clz(value);
-    if(bucket >= NUM_BUCKETS + 2) return NUM_BUCKETS - 1;
-    return bucket - 3;
+    int bits = INT_BITS -__builtin_clz(value);
+    int bucket = (bits - BUCKET_BASE_BITS) << BUCKET_SPLIT_BITS;
+    if(BUCKET_SPLIT_BITS > 0) 
+        bucket += (value >> (bits - 1 - BUCKET_SPLIT_BITS)) & ((1 << BUCKET_SPLIT_BITS) - 1);
+    if(bucket >= NUM_BUCKETS) return NUM_BUCKETS - 1;
+    return bucket;
 }
 
 /**
@@ -166,62 +348,237 @@ static inline void *get_prev(void *block){
 }
 
 /**
- * Sets the flag of the block above 'block' to ensure that it 
- * knows that the block below it is free
+ * Returns if a given block is free or not, going down from 
+ * the payload to read the flag from the header
+ */
+static inline bool is_free(void * payload){
+    return ((get_payloadsz(payload)&FREE_MASK) != 0);
+}
+
+/**
+ * Returns the payload of the block directly above a given block
  */
-static inline void set_prevfree(void* block){
-    ((headerT *)(get_next(block)))->payloadsz |= PREV_FREE;
+static inline void *next_block(void *block){
+    return payload_for_hdr(get_next(block));
 }
 
 /**
- * Sets the flag of the block below 'block' to ensure that it 
- * knows that the block above it is free
+ * Returns if two neighbouring blocks of these sizes can be merged, the
+ * header between them included, without going past the largest size a
+ * header can hold, which heaps over 2 GB can reach
  */
-static inline void set_nextfree(void* block){  
-    hdr_for_payload(get_prev(block))->payloadsz |= NEXT_FREE;
+static inline bool fits_block(size_t size, size_t other){
+    return size + sizeof(headerT) + other <= SIZE_MASK;
 }
 
 /**
- * Sets the flag of a given block to show that it is presently
- * free
+ * Lays the bytes from the payload of run up to end out as free blocks, as
+ * few as the largest block size allows, and returns the last of them.
+ * Their neighbours are left for the caller to bring up to date.
  */
-static inline void set_free(void * payload){
-    set_payload_size(payload, (get_payloadsz(payload) | FREE_MASK));
+static void *free_run(void *run, char *end){
+    while((size_t)(end - (char *)run) > SIZE_MASK){
+        set_payload_size(run, SIZE_MASK | FREE_MASK);
+        run = (char *)run + SIZE_MASK + sizeof(headerT);
+    }
+    set_payload_size(run, (end - (char *)run) | FREE_MASK);
+    return run;
 }
 
+#ifdef FREE_BITMAP
 /**
- * Returns if a given block is free or not, going down from 
- * the payload to read the flag from the header
+ * Returns the position in the bitmap of the granule where block starts
  */
-static inline bool is_free(void * payload){
-    return ((get_size(payload)&FREE_MASK) != 0);
+static inline size_t granule(myheap_t *heap, void *block){
+    return ((char *)block - heap->heap_base)/ALIGNMENT;
+}
+
+/**
+ * Returns the bit of the bitmap that records if block is free
+ */
+static inline bool test_free_bit(myheap_t *heap, void *block){
+    size_t bit = granule(heap, block);
+    return (heap->free_bitmap[bit/WORD_BITS] >> (bit%WORD_BITS)) & 1;
+}
+
+/**
+ * Records in the bitmap whether block is free
+ */
+static inline void write_free_bit(myheap_t *heap, void *block, bool free){
+    size_t bit = granule(heap, block);
+    if(free) heap->free_bitmap[bit/WORD_BITS] |= 1UL << (bit%WORD_BITS);
+    else heap->free_bitmap[bit/WORD_BITS] &= ~(1UL << (bit%WORD_BITS));
+}
+
+/**
+ * Return if the block has a free block above it 
+ */
+static inline bool has_next_free(myheap_t *heap, void *payload){
+    return payload != heap->max_block && test_free_bit(heap, next_block(payload));
 }
 
+/**
+ * Returns if the block has a free block below it
+ */
+static inline bool has_prev_free(myheap_t *heap, void * payload){
+    return payload != heap->min_block && test_free_bit(heap, get_prev(payload));
+}
+#else
 /**
  * Return if the block has a free block above it 
  */
-static inline bool has_next_free(void *payload){
+static inline bool has_next_free(myheap_t *heap, void *payload){
     return ((get_payloadsz(payload)&NEXT_FREE) != 0);
 }
 
 /**
  * Returns if the block has a free block below it
  */
-static inline bool has_prev_free(void * payload){
+static inline bool has_prev_free(myheap_t *heap, void * payload){
     return ((get_payloadsz(payload)&PREV_FREE) != 0);
 }
+#endif
+
+/**
+ * Returns if a free block is big enough to hold the two free-list
+ * pointers, blocks smaller than that are garbage and are never listed
+ */
+static inline bool is_listed(void *payload){
+    return get_size(payload) >= 2*sizeof(void *);
+}
+
+/**
+ * Function: update_neighbours
+ * ---------------------------
+ * Must be called whenever the size or the free status of block changes.
+ * Tells the block above the new size of block, sets the NEXT_FREE flag of
+ * the block below and the PREV_FREE flag of the block above to reflect
+ * whether block is free, and refreshes the flags block keeps about them.
+ * With FREE_BITMAP only the bit of block and the size below are written.
+ */
+#ifdef FREE_BITMAP
+static inline void update_neighbours(myheap_t *heap, void *block){
+    write_free_bit(heap, block, is_free(block));
+    if(block != heap->max_block) set_prevpayload_size(next_block(block), get_size(block));
+}
+#else
+static inline void update_neighbours(myheap_t *heap, void *block){
+    unsigned int flags = 0;
+    bool block_free = is_free(block);
+    if(block != heap->min_block){
+        void *prev = get_prev(block);
+        if(is_free(prev)) flags |= PREV_FREE;
+        if(block_free) hdr_for_payload(prev)->payloadsz |= NEXT_FREE;
+        else hdr_for_payload(prev)->payloadsz &= ~NEXT_FREE;
+    }
+    if(block != heap->max_block){
+        void *next = next_block(block);
+        set_prevpayload_size(next, get_size(block));
+        if(is_free(next)) flags |= NEXT_FREE;
+        if(block_free) hdr_for_payload(next)->payloadsz |= PREV_FREE;
+        else hdr_for_payload(next)->payloadsz &= ~PREV_FREE;
+    }
+    hdr_for_payload(block)->payloadsz = 
+        (get_payloadsz(block) & ~(PREV_FREE|NEXT_FREE)) | flags;
+}
+#endif
+
+/**
+ * Writes the size and free status of block and brings its neighbours
+ * up to date. Any flags previously stored in the header are recomputed.
+ */
+static inline void set_block(myheap_t *heap, void *block, unsigned int size, bool free){
+    set_payload_size(block, free ? (size|FREE_MASK) : size);
+    update_neighbours(heap, block);
+}
 
 /**
  * Sets all of the buckets of the segregated freelist 
  * to NULL to initialise it.
  */
-static inline void clear_buckets(){
+static inline void clear_buckets(myheap_t *heap){
     for(int i = 0; i < NUM_BUCKETS; i ++){
-        *(void **)((char*)buckets + i*sizeof(void*)) = NULL;
+        *(void **)((char*)heap->buckets + i*sizeof(void*)) = NULL;
+    }
+#ifdef FREE_INDEX
+    for(int i = 0; i < NUM_BUCKETS; i++) heap->bucket_len[i] = 0;
+#endif
+}
+
+#ifdef FREE_INDEX
+/**
+ * Returns the payload of the block that an index entry refers to
+ */
+static inline void *block_at(myheap_t *heap, indexT entry){
+    return heap->heap_base + (size_t)entry.offset*ALIGNMENT;
+}
+
+/**
+ * Works out where each bucket's array goes in the side segment of the
+ * index and returns the size of the whole segment. A bucket never holds
+ * more entries than blocks of its smallest size fit in the largest
+ * segment, the untouched part of the reservation costs nothing.
+ */
+static size_t index_layout(size_t offsets[NUM_BUCKETS]){
+    size_t total = 0;
+    for(int i = 0; i < NUM_BUCKETS; i++){
+        size_t min_size = 1L << ((i >> BUCKET_SPLIT_BITS) + BUCKET_BASE_BITS - 1);
+        if(min_size < 16) min_size = 16;
+        offsets[i] = total;
+        total += roundup(MAX_SEGMENT_SIZE/(min_size + sizeof(headerT))*sizeof(indexT), PAGE_SIZE);
+    }
+    return total;
+}
+
+/**
+ * Reserves the side arrays for the index the first time round, otherwise
+ * just empties them
+ */
+static bool init_index(myheap_t *heap){
+    if(heap->bucket_index[0] == NULL){
+        size_t offsets[NUM_BUCKETS];
+        char *side = reserve_side_segment(index_layout(offsets));
+        if(side == NULL) return false;
+        for(int i = 0; i < NUM_BUCKETS; i++) heap->bucket_index[i] = (indexT *)(side + offsets[i]);
+    }
+    for(int i = 0; i < NUM_BUCKETS; i++) heap->bucket_len[i] = 0;
+    return true;
+}
+
+/**
+ * Function: remove_from_list
+ * --------------------------
+ * Removes the block pointed to by curr from the index of bucket_num. The
+ * last entry of the bucket moves into the hole and its block is told its
+ * new slot.
+ */
+static inline void remove_from_list(myheap_t *heap, void *curr, int bucket_num){
+    heap->stats.relinks++;
+    unsigned int slot = *(unsigned int *)curr;
+    unsigned int last = --heap->bucket_len[bucket_num];
+    if(slot != last){
+        indexT moved = heap->bucket_index[bucket_num][last];
+        heap->bucket_index[bucket_num][slot] = moved;
+        *(unsigned int *)block_at(heap, moved) = slot;
     }
 }
 
-void *coalesce(void *ptr);
+/**
+ * Function: add_to_list
+ * ---------------------
+ * Appends an entry for the free block ptr to the index of its bucket.
+ */
+static inline void add_to_list(myheap_t *heap, void *ptr){
+    heap->stats.relinks++;
+    int bucket = cal_bucket(get_size(ptr));
+    unsigned int slot = heap->bucket_len[bucket]++;
+    heap->bucket_index[bucket][slot].offset = ((char *)ptr - heap->heap_base)/ALIGNMENT;
+    heap->bucket_index[bucket][slot].size = get_size(ptr);
+    *(unsigned int *)ptr = slot;
+}
+#else
+
+void *coalesce(myheap_t *heap, void *ptr);
 
 /**
  * Function: remove_from_list
@@ -229,7 +586,8 @@ void *coalesce(void *ptr);
  * Removes the block pointed to by curr from the list given by
  * bucket_num from that segregated list.
  */
-static inline void remove_from_list(void *curr, int bucket_num){
+static inline void remove_from_list(myheap_t *heap, void *curr, int bucket_num){
+    heap->stats.relinks++;
     //gets prev_free and next_free to remove block from the list
     void* prev_free = get_prev_in_list(curr);
     void* next_free = get_next_in_list(curr);
@@ -237,12 +595,45 @@ static inline void remove_from_list(void *curr, int bucket_num){
     if(prev_free != NULL){ 
         set_next_in_list(prev_free, next_free);
     } else{
-        buckets[bucket_num] = next_free;
+        heap->buckets[bucket_num] = next_free;
     } 
     //next gets prev
     if(next_free != NULL) set_prev_in_list(next_free, prev_free);
 }
 
+/**
+ * Function: add_to_list
+ * ---------------------
+ * Inserts the free block ptr into the segregated list for its size,
+ * keeping every list sorted by increasing size so that the first block
+ * that fits in a list is also the smallest one that does. Without
+ * SORTED_LISTS the block is pushed on the front of the list.
+ */
+static inline void add_to_list(myheap_t *heap, void *ptr){
+    heap->stats.relinks++;
+    int bucket = cal_bucket(get_size(ptr));
+    void *curr = heap->buckets[bucket];
+    void *prev = NULL;
+    while(SORTED_LISTS && curr != NULL && get_size(curr) < get_size(ptr)){
+        prev = curr;
+        curr = get_next_in_list(curr);
+    }
+    set_next_in_list(ptr, curr);
+    set_prev_in_list(ptr, prev);
+    if(curr != NULL) set_prev_in_list(curr, ptr);
+    if(prev != NULL) set_next_in_list(prev, ptr);
+    else heap->buckets[bucket] = ptr;
+}
+#endif
+
+/**
+ * Takes a free block off its segregated list, garbage blocks are
+ * not on any list so there is nothing to do for them
+ */
+static inline void unlink_free(myheap_t *heap, void *ptr){
+    if(is_listed(ptr)) remove_from_list(heap, ptr, cal_bucket(get_size(ptr)));
+}
+
 /* The responsibility of the myinit function is to configure a new
  * empty heap. Typically this function will initialize the
  * segment (you decide the initial number pages to set aside, can be
@@ -254,390 +645,1778 @@ static inline void remove_from_list(void *curr, int bucket_num){
  * needed by the test harness to run a sequence of scripts, one after another,
  * without restarting program from scratch.
  */
-bool myinit()
-{   
+#ifdef FREE_BITMAP
+/**
+ * Reserves the bitmap the first time round, otherwise clears the part
+ * of it covering the heap that is about to be discarded
+ */
+static bool init_bitmap(myheap_t *heap){
+    if(heap->free_bitmap == NULL){
+        heap->free_bitmap = reserve_side_segment(MAX_SEGMENT_SIZE/ALIGNMENT/CHAR_BIT);
+        return heap->free_bitmap != NULL;
+    }
+    memset(heap->free_bitmap, 0, heap->segment->size/ALIGNMENT/CHAR_BIT + sizeof(long));
+    return true;
+}
+#endif
+
+/**
+ * Function: init_blocks
+ * ---------------------
+ * Empties heap and lays it out as a single free block over the size bytes
+ * at base, which is where the blocks of the heap start from now on. The
+ * first header is moved up as far as it takes to put its payload on
+ * PAYLOAD_ALIGNMENT. Returns false if that leaves no room for the
+ * smallest block that can be handed out.
+ */
+static bool init_blocks(myheap_t *heap, char *base, size_t size)
+{
+    size_t shift = roundup((size_t)base + sizeof(headerT), PAYLOAD_ALIGNMENT) - sizeof(headerT) - (size_t)base;
+    if(size < shift + sizeof(headerT) + payload_size(MIN_PAYLOAD)) return false;
+    base += shift;
+    size -= shift;
     //empty buckets
-    clear_buckets();
+    clear_buckets(heap);
+    memset(&heap->stats, 0, sizeof(heap->stats));
+    heap->heap_base = base;
+#ifdef FREE_INDEX
+    if(!init_index(heap)) return false;
+#endif
+#ifdef QUICK_LISTS
+    memset(heap->quick, 0, sizeof(heap->quick));
+    heap->quick_count = 0;
+    heap->sweep_next = 0;
+#endif
+    heap->free_handles = NULL;
+    heap->handles_used = 0;
     //initialize the first block
-    void *first = init_heap_segment(INIT_PAGES);
-    if(first == NULL) return false;
-    first = payload_for_hdr(first);
-    max_block = first;
-    min_block = first;
+    void *first = payload_for_hdr((headerT *)base);
+    heap->max_block = first;
+    heap->min_block = first;
     // set the sizes
-    set_payload_size(first, (INIT_PAGES*PAGE_SIZE - sizeof(headerT))|FREE_MASK); 
+    set_payload_size(first, (size - sizeof(headerT))|FREE_MASK); 
     set_prevpayload_size(first, INIT_MASK);
+    update_neighbours(heap, first);
      // add the first segment to the bucket-list
-    int bucket = cal_bucket(get_size(first));
-    set_next_in_list(first, NULL);
-    set_prev_in_list(first, NULL);
-    buckets[bucket] = first;
+    add_to_list(heap, first);
     return true;
 }
 
+bool myinit()
+{   
+    myheap_t *heap = &default_heap;
+    heap->segment = default_segment();
+    myheap_destroy(heap->long_lived);
+    heap->long_lived = NULL;
+    myheap_destroy(heap->overflow);
+    heap->overflow = NULL;
+#ifdef FREE_BITMAP
+    if(!init_bitmap(heap)) return false;
+#endif
+    void *start = init_heap_segment(INIT_PAGES);
+    if(start == NULL) return false;
+    return init_blocks(heap, start, INIT_PAGES*PAGE_SIZE);
+}
+
+bool myinit_once()
+{
+    return default_heap.max_block != NULL || myinit();
+}
+
 /**
- * Function: get_free_space
+ * Function: myheap_create
+ * -----------------------
+ * Reserves a segment of its own for a new heap. The heap state is kept in
+ * the first bytes of the segment and the blocks follow it, the first
+ * pages opened up hold INIT_PAGES pages worth of blocks at most.
+ */
+myheap_t *myheap_create()
+{
+    size_t reserved = roundup(sizeof(myheap_t), ALIGNMENT);
+    size_t npages = roundup(reserved + sizeof(headerT) + MIN_PAYLOAD, PAGE_SIZE)/PAGE_SIZE;
+    if(npages < INIT_PAGES) npages = INIT_PAGES;
+    segment_t segment = {NULL, 0};
+    char *start = segment_init(&segment, npages);
+    if(start == NULL) return NULL;
+    myheap_t *heap = (myheap_t *)start;
+    heap->own_segment = segment;
+    heap->segment = &heap->own_segment;
+    bool ok = true;
+#ifdef FREE_BITMAP
+    ok = init_bitmap(heap);
+#endif
+    if(!ok || !init_blocks(heap, start + reserved, npages*PAGE_SIZE - reserved)){
+        myheap_destroy(heap);
+        return NULL;
+    }
+    return heap;
+}
+
+/**
+ * Function: myheap_init_in
  * ------------------------
- * Searches through the free-list given by bucket initially to find a free space 
- * large enough for the requested size, if no space is found goes up the buckets 
- * to find any space that can fit, retuns a space if available else returns NULL
- * in which case a new page is required
+ * Lays a heap out over the len bytes at base, the heap state first and the
+ * blocks after it, as myheap_create does in a segment of its own. Only
+ * memory is written, the region cannot grow so an allocation that does not
+ * fit in it fails. Regions past the largest block size are only used up to
+ * that size.
  */
-static inline void *get_free_space(int bucket, int* bucketNo,  size_t requestedsz){
-    // start at the bucket and iterate through until right size is found
-    for (int i = bucket; i < NUM_BUCKETS; i++){
-        void *curr = buckets[i]; 
-        while(curr != NULL){
-            if(get_size(curr) >= requestedsz){ 
-                remove_from_list(curr, i);
-                *bucketNo = i;
-                return curr;
-            }
-            curr = get_next_in_list(curr);
-        }  
+myheap_t *myheap_init_in(void *base, size_t len)
+{
+    char *start = (char *)roundup((size_t)base, ALIGNMENT);
+    size_t reserved = roundup(sizeof(myheap_t), ALIGNMENT);
+    if(base == NULL || len < (size_t)(start - (char *)base) + reserved + sizeof(headerT) + MIN_PAYLOAD) return NULL;
+    size_t nbytes = (len - (start - (char *)base)) & ~(size_t)(ALIGNMENT - 1);
+    if(nbytes > reserved + SIZE_MASK) nbytes = reserved + SIZE_MASK;
+    myheap_t *heap = (myheap_t *)start;
+    memset(heap, 0, sizeof(myheap_t));
+    segment_init_in(&heap->own_segment, start, nbytes);
+    heap->segment = &heap->own_segment;
+    bool ok = true;
+#ifdef FREE_BITMAP
+    ok = init_bitmap(heap);
+#endif
+    if(!ok || !init_blocks(heap, start + reserved, nbytes - reserved)){
+        myheap_destroy(heap);
+        return NULL;
     }
-    //return NULL if there is not a large enough block
-    return NULL;
+    return heap;
 }
 
 /**
- * Function: get_new_page
- * ----------------------
- * Makes a new page in order to store the requestedsz, handles the case of 
- * a perfect fit, a garbage block or a freeable block. Calls the page 
- * handler to extend the heap segment. Returns a pointer to the base payload
- * of the page which malloc will return. 
- */
-void *get_new_page(size_t requestedsz){
-        size_t npages = roundup(requestedsz + sizeof(headerT), PAGE_SIZE)/PAGE_SIZE;
-        headerT *header = extend_heap_segment(npages);
-        void *page = payload_for_hdr(header);
-        // set sizes
-        set_payload_size(page, requestedsz);
-        set_prevpayload_size(page, get_size(max_block));
-        // remember if max is free
-        if((get_size(max_block)&FREE_MASK) != 0) set_prevfree(page); 
-        // perfect fit
-        int size_left = npages*PAGE_SIZE - requestedsz - sizeof(headerT); 
-        if(size_left== 0){
-            max_block = page;
-            return page;
-        }
-        // garbage
-        if(size_left < sizeof(headerT)+ 2*sizeof(void *)){
-            void* next_free = get_next(page);
-            next_free = payload_for_hdr(next_free);
-            set_payload_size(next_free, (npages*PAGE_SIZE - requestedsz - 2*sizeof(headerT))|FREE_MASK);
-            set_prevpayload_size(next_free, requestedsz); 
-            set_nextfree(next_free);
-            max_block = next_free;
-            return page;
-        }
-        // fit with freeable block
-        void *curr = get_next(page);
-        curr = payload_for_hdr(curr);
-        set_payload_size(curr, size_left - sizeof(headerT));
-        set_prevpayload_size(curr, requestedsz);
-        myfree(curr);
-        max_block = curr;
-        return page;
+ * Function: myheap_destroy
+ * ------------------------
+ * Gives back the segment of heap along with any side segments, which
+ * frees every block in the heap at once.
+ */
+void myheap_destroy(myheap_t *heap)
+{
+    if(heap == NULL || heap == &default_heap) return;
+    myheap_destroy(heap->long_lived);
+    myheap_destroy(heap->overflow);
+#ifdef FREE_INDEX
+    size_t offsets[NUM_BUCKETS];
+    release_side_segment(heap->bucket_index[0], index_layout(offsets));
+#endif
+#ifdef FREE_BITMAP
+    release_side_segment(heap->free_bitmap, MAX_SEGMENT_SIZE/ALIGNMENT/CHAR_BIT);
+#endif
+    release_side_segment(heap->handles, MAX_HANDLES*sizeof(struct myhandle));
+    // the heap lives in the segment, so release a copy
+    segment_t segment = heap->own_segment;
+    segment_release(&segment);
+}
 
+/**
+ * Brings the neighbour sizes and flags of every block up to date, walking
+ * up from min_block, and lists the free blocks. For after a pass that
+ * rewrote block headers wholesale, with the lists cleared.
+ */
+static void relist_blocks(myheap_t *heap){
+    for(void *curr = heap->min_block; ; curr = next_block(curr)){
+        update_neighbours(heap, curr);
+        if(is_free(curr) && is_listed(curr)) add_to_list(heap, curr);
+        if(curr == heap->max_block) break;
+    }
 }
 
 /**
- * Function: mymalloc 
- * ------------------
- * Scans thorugh the explicit segregated freelist in order to find if there is 
- * a space available for the users requested size, if none is available it 
- * will call the page manager to ask for more space. Handles all of the extra
- * space either setting it as usable garbage or free space which is freed by
- * myfree. Returns a pointer to a space of exact or larger than requested size.
+ * Returns if heap is only ever used by this process, so that it can refer
+ * to memory of the process outside of its segment
  */
-void *mymalloc(size_t requestedsz)
-{  
-    if(requestedsz == 0) return NULL;
-    // align requested sz
-    requestedsz = roundup(requestedsz, ALIGNMENT);
-    if(requestedsz < 16) requestedsz = 16;
-    // get available space from the list if possible
-    int bucket = cal_bucket((unsigned int)requestedsz);
-    int bucketNo;
-    void *curr = get_free_space(bucket, &bucketNo, requestedsz);
-    // no free space available 
-    if(curr == NULL) return get_new_page(requestedsz); 
-    // found in free-list
-    unsigned int tmp = get_size(curr);
-    set_payload_size(curr, requestedsz);
-    unsigned int remaining_size = tmp - requestedsz;
-    // fit with freeable block
-    if(remaining_size >= sizeof(headerT) + 2*sizeof(void*)){   
-        // set the next free block
-        void *next_free = get_next(curr);
-        next_free = payload_for_hdr(next_free);
-        set_payload_size(next_free, remaining_size - sizeof(headerT)); 
-        set_prevpayload_size(next_free, requestedsz);
-        // set next block if possible
-        if(next_free < max_block){
-           set_prevpayload_size(payload_for_hdr(get_next(next_free)), get_size(next_free)); 
-           set_prevfree(next_free);
-        }
-        if(next_free > max_block) max_block = next_free;
-        myfree(next_free);
-    } else if(requestedsz != tmp) { // garbage
-        // make garbage block
-        void *next_free = get_next(curr);
-        next_free = payload_for_hdr(next_free);
-        set_payload_size(next_free, ((remaining_size - sizeof(headerT))|FREE_MASK));
-        set_prevpayload_size(next_free, requestedsz); 
-        // set next block if possible
-        if(next_free > max_block) max_block = next_free;
-        else if(next_free < max_block) {
-            set_prevpayload_size(payload_for_hdr(get_next(next_free)), get_size(next_free));
-            set_prevfree(next_free);
-            if(is_free(payload_for_hdr(get_next(next_free)))){
-                set_payload_size(next_free, (get_size(next_free)|NEXT_FREE));
-            }
-        }
-        // tell block above I'm free
-        if(next_free > min_block) set_nextfree(next_free);
-        coalesce(next_free);
-    }else{ // perfect fit
-        // undo prev free 
-        if(curr < max_block) {
-            ((headerT*)((char *)curr +
-                hdr_for_payload(curr)->payloadsz))->payloadsz &= ~(PREV_FREE);
+static inline bool private_heap(myheap_t *heap){
+    return !heap->own_segment.file_backed && !heap->shared;
+}
+
+/**
+ * Makes heap usable again after its blocks were brought back delta bytes
+ * from where they were, as they were left. The pointers the heap keeps are
+ * moved by delta, the quick lists by walking them, and the free lists are
+ * rebuilt by a walk over the blocks if they moved. The free index and the
+ * bitmap are rebuilt by the same walk whether they moved or not, the
+ * bitmap must have been set up for the heap already.
+ */
+static bool reattach(myheap_t *heap, ptrdiff_t delta){
+    bool relist = delta != 0;
+#if defined(FREE_INDEX) || defined(FREE_BITMAP)
+    relist = true;
+#endif
+    if(heap->root != NULL) heap->root = (char *)heap->root + delta;
+    heap->heap_base += delta;
+    heap->min_block = (char *)heap->min_block + delta;
+    heap->max_block = (char *)heap->max_block + delta;
+#ifdef QUICK_LISTS
+    for(int i = 0; i < NUM_QUICK && delta != 0; i++){
+        for(void **link = &heap->quick[i]; *link != NULL; link = (void **)*link){
+            *link = (char *)*link + delta;
         }
     }
-    // unset NF for thing below curr, if possible
-    if(curr > min_block) {
-        void *prev = get_prev(curr);
-        hdr_for_payload(prev)->payloadsz &= ~(NEXT_FREE);
-        if(is_free(prev)) set_prevfree(prev); 
-    }
-    // go to the thing above curr, if it is possible, and change curr to be NF if the thing there is free.
-    if(curr < max_block) {
-        void *next = get_next(curr);
-        next = payload_for_hdr(next);
-        if(is_free(next)) set_nextfree(next); 
+#endif
+#ifdef FREE_INDEX
+    if(!init_index(heap)) return false;
+#endif
+    if(relist){
+        clear_buckets(heap);
+        relist_blocks(heap);
     }
-    return curr;
+    return true;
 }
 
 /**
- * Funciton: coalesce
- * ------------------
- * Given a pointer to a free-block's payload, coalesce will look up and
- * down to find if the spaces are free and then will conjoin those spaces to make
- * larger blocks of space, this will also do garbage clean-up by coalescing 
- * garbage blocks.
- */
-void *coalesce(void *ptr) {
-    bool prev_is_free = has_prev_free(ptr);
-    bool next_is_free = has_next_free(ptr); 
-    unsigned int ptr_size = get_size(ptr);
-    if((!prev_is_free) && (!next_is_free)) { // no coalesce
-        return ptr;
-    } else if((!prev_is_free) && (next_is_free)) { // coalesce up
-        // get next block
-        void* next_block = payload_for_hdr(get_next(ptr));
-        unsigned int next_size = get_size(next_block);
-        int bucket = cal_bucket(next_size);
-        // remove from free-list if not garbage
-        if(next_size >= 2*sizeof(void*))remove_from_list(next_block, bucket);
-        // set new block
-        unsigned int new_size = ptr_size + next_size + sizeof(headerT);
-        set_payload_size(ptr, (new_size | (get_payloadsz(next_block)&NEXT_FREE)));
-        if(next_block < max_block){
-            void *next_next_block = payload_for_hdr(get_next(next_block));
-            set_prevpayload_size(next_next_block, new_size);
+ * Function: myheap_open
+ * ---------------------
+ * Maps the heap file at path, making a new heap in it if the file is
+ * empty or does not exist. A file made before is mapped back where it was
+ * the last time if that range is free, in which case the heap is used as
+ * it was left, otherwise it is reattached where it landed. The free index
+ * and bitmap are not kept in the file, they are rebuilt every time. The
+ * file is locked while open so that only one heap maps it.
+ */
+myheap_t *myheap_open(const char *path)
+{
+    int fd = open(path, O_RDWR|O_CREAT, 0600);
+    if(fd == -1) return NULL;
+    myheap_t saved;
+    ssize_t got = flock(fd, LOCK_EX|LOCK_NB) == -1 ? -1 : pread(fd, &saved, sizeof(saved), 0);
+    bool fresh = got == 0;
+    size_t reserved = roundup(sizeof(myheap_t), ALIGNMENT);
+    size_t npages = roundup(reserved + sizeof(headerT) + MIN_PAYLOAD, PAGE_SIZE)/PAGE_SIZE;
+    if(npages < INIT_PAGES) npages = INIT_PAGES;
+    if((!fresh && (got != sizeof(saved) || saved.magic != PERSIST_MAGIC + sizeof(myheap_t))) ||
+            (fresh && ftruncate(fd, npages*PAGE_SIZE) == -1)){
+        close(fd);
+        return NULL;
+    }
+    segment_t segment = {NULL, 0};
+    char *start = segment_map_file(&segment, fd, fresh ? NULL : saved.mapped_at);
+    if(start == NULL){
+        close(fd);
+        return NULL;
+    }
+    myheap_t *heap = (myheap_t *)start;
+    heap->own_segment = segment;
+    heap->segment = &heap->own_segment;
+    heap->shared = false;
+    heap->long_lived = NULL;
+    heap->overflow = NULL;
+    heap->handles = NULL;
+    heap->free_handles = NULL;
+    heap->handles_used = 0;
+#ifdef FREE_INDEX
+    heap->bucket_index[0] = NULL;
+#endif
+#ifdef FREE_BITMAP
+    heap->free_bitmap = NULL;
+    if(!init_bitmap(heap)){
+        myheap_destroy(heap);
+        return NULL;
+    }
+#endif
+    if(fresh){
+        heap->magic = PERSIST_MAGIC + sizeof(myheap_t);
+        heap->root = NULL;
+        if(!init_blocks(heap, start + reserved, npages*PAGE_SIZE - reserved)){
+            myheap_destroy(heap);
+            return NULL;
         }
-        // remember max
-        if(next_block == max_block) max_block = ptr;
-        return ptr;
-    } else if((!next_is_free) && (prev_is_free)) { //coalesce down
-        // get prev block
-        void *prev_block = get_prev(ptr);
-        unsigned int prev_size = get_size(prev_block);
-        int bucket = cal_bucket(prev_size);
-        // remove from free list if not garbage
-        if(prev_size >= 2*sizeof(void*))remove_from_list(prev_block, bucket);
-        // set new block
-        unsigned int new_size = ptr_size + prev_size + sizeof(headerT);
-        set_payload_size(prev_block, (new_size | (get_payloadsz(prev_block)&PREV_FREE)));
-        if(ptr < max_block){
-            void *next_block = payload_for_hdr(get_next(ptr));
-            set_prevpayload_size(next_block, new_size);
+    } else if(!reattach(heap, start - heap->mapped_at)){
+        myheap_destroy(heap);
+        return NULL;
+    }
+    heap->mapped_at = start;
+    return heap;
+}
+
+#if !defined(FREE_INDEX) && !defined(FREE_BITMAP)
+/**
+ * Returns if the heap state saved at the front of a shared memory object
+ * of objsize bytes is one that myheap_open_shared finished setting up, in
+ * a build with the same policies, with its blocks inside the segment
+ */
+static bool shared_state_valid(const myheap_t *saved, off_t objsize){
+    char *start = saved->mapped_at;
+    const segment_t *seg = &saved->own_segment;
+    size_t reserved = roundup(sizeof(myheap_t), ALIGNMENT);
+    return saved->magic == PERSIST_MAGIC + sizeof(myheap_t) && saved->shared &&
+        objsize == MAX_SEGMENT_SIZE && start != NULL && (size_t)start % PAGE_SIZE == 0 &&
+        seg->start == start && seg->shared && !seg->file_backed && !seg->fixed &&
+        (char *)saved->segment == start + offsetof(myheap_t, own_segment) &&
+        seg->size % PAGE_SIZE == 0 && seg->size > reserved && seg->size <= MAX_SEGMENT_SIZE &&
+        saved->heap_base >= start + reserved && (char *)saved->min_block > saved->heap_base &&
+        (char *)saved->max_block >= (char *)saved->min_block &&
+        (char *)saved->max_block < start + seg->size;
+}
+#endif
+
+/**
+ * Function: myheap_open_shared
+ * ----------------------------
+ * Maps the heap in the POSIX shared memory object name, making a new heap
+ * in it if the object is empty or does not exist. The object is sized to
+ * the largest segment up front and mapped whole, the pages only take up
+ * memory once they are opened up and touched, and opening up more of the
+ * segment in one process opens it up in all of them. The free lists hold
+ * plain pointers, so every process must map the heap at the address the
+ * process that made it did. Setting up and attaching are serialized with
+ * a lock on the object, after that the processes take turns on the heap
+ * through the mutex in it.
+ */
+myheap_t *myheap_open_shared(const char *name)
+{
+#if defined(FREE_INDEX) || defined(FREE_BITMAP)
+    (void)name;
+    return NULL; // the index and bitmap would be private to each process
+#else
+    int fd = shm_open(name, O_RDWR|O_CREAT, 0600);
+    if(fd == -1) return NULL;
+    if(flock(fd, LOCK_EX) == -1){
+        close(fd);
+        return NULL;
+    }
+    myheap_t *heap = NULL;
+    segment_t segment = {NULL, 0};
+    struct stat st;
+    if(fstat(fd, &st) == 0 && st.st_size == 0){
+        size_t reserved = roundup(sizeof(myheap_t), ALIGNMENT);
+        size_t npages = roundup(reserved + sizeof(headerT) + MIN_PAYLOAD, PAGE_SIZE)/PAGE_SIZE;
+        if(npages < INIT_PAGES) npages = INIT_PAGES;
+        char *start = ftruncate(fd, MAX_SEGMENT_SIZE) == 0 ? segment_map_shared(&segment, fd, NULL) : NULL;
+        if(start != NULL){
+            heap = (myheap_t *)start;
+            heap->own_segment = segment;
+            heap->segment = &heap->own_segment;
+            pthread_mutexattr_t attr;
+            pthread_mutexattr_init(&attr);
+            pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+            pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+            pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+            bool ready = pthread_mutex_init(&heap->lock, &attr) == 0 &&
+                segment_extend(heap->segment, npages) != NULL &&
+                init_blocks(heap, start + reserved, npages*PAGE_SIZE - reserved);
+            pthread_mutexattr_destroy(&attr);
+            if(ready){
+                heap->magic = PERSIST_MAGIC + sizeof(myheap_t);
+                heap->mapped_at = start;
+                heap->shared = true;
+            } else {
+                heap = NULL;
+                segment_release(&segment);
+            }
         }
-        // remember max
-        if(ptr == max_block) max_block = prev_block;
-        return prev_block;
-    } else { // coalesce up and down
-        // get previous block
-        void *prev_block = get_prev(ptr);        
-        unsigned int prev_size = get_size(prev_block);
-        // get next block
-        void* next_block = payload_for_hdr(get_next(ptr));
-        unsigned int next_size = get_size(next_block);    
-        // remove both from free list if not garbage
-        int bucket = cal_bucket(next_size);
-        if(next_size >= 2*sizeof(void*))remove_from_list(next_block, bucket);
-        bucket = cal_bucket(prev_size);
-        if(prev_size >= 2*sizeof(void*))remove_from_list(prev_block, bucket);
-        // set new block
-        unsigned int new_size = prev_size + sizeof(headerT) + ptr_size + sizeof(headerT) + next_size;
-        set_payload_size(prev_block, (new_size | (get_size(prev_block)&PREV_FREE)));   
-        if(next_block < max_block){
-            void *next_next_block = payload_for_hdr(get_next(next_block));
-            set_prevpayload_size(next_next_block, new_size);
+        // left empty, the next process to open the object makes the heap over again
+        if(heap == NULL) ftruncate(fd, 0);
+    } else {
+        myheap_t saved;
+        if(pread(fd, &saved, sizeof(saved), 0) == sizeof(saved) && shared_state_valid(&saved, st.st_size)){
+            heap = segment_map_shared(&segment, fd, saved.mapped_at);
         }
-        // remember if max
-        if(next_block == max_block) max_block = prev_block;
-        return prev_block;
     }
-    return ptr;
+    flock(fd, LOCK_UN);
+    close(fd);
+    return heap;
+#endif
 }
 
 /**
- * Function: myfree
- * ----------------
- * Takes a pointer to a block currentluy allocated by the user, will add the
- * block to the appropriate bucket in the segregated free-list, as well as 
- * call coalesce to make larger spaces if appplicable. 
+ * Takes the lock of a shared heap. A process that died holding it may
+ * have left the heap half changed, that is not repaired, the lock is
+ * only made usable again. Returns false if the lock cannot be had, in
+ * which case the heap must be left alone.
  */
-void myfree(void *ptr){
-    if(ptr == NULL) return;
-    // coalesce
-    ptr = coalesce(ptr);
-    // set flags above
-    if(ptr < max_block) set_prevfree(ptr);
-    // set flags below
-    if(ptr != min_block) set_nextfree(ptr);
-    // set free flag
-    set_free(ptr);
-    // remember if max
-    if(ptr > max_block) max_block = ptr;
-    // get bucket
-    int bucket = cal_bucket(get_size(ptr));
-    void *bucketFirst = buckets[bucket];
-    // add to list
-    void *curr = buckets[bucket];
-    if(curr == NULL){
-        set_prev_in_list(ptr, NULL);
-        set_next_in_list(ptr, bucketFirst);
-        if(bucketFirst != NULL) set_prev_in_list(bucketFirst, ptr);
-        buckets[bucket] = ptr;
-        return;
-    }else if(get_size(curr) > get_size(ptr) ){
-        set_prev_in_list(ptr, NULL);
-        set_next_in_list(ptr, bucketFirst);
-        if(bucketFirst != NULL) set_prev_in_list(bucketFirst, ptr);
-        buckets[bucket] = ptr;
-        return;
+static inline bool lock_heap(myheap_t *heap){
+    if(!heap->shared) return true;
+    int err = pthread_mutex_lock(&heap->lock);
+    if(err == EOWNERDEAD) err = pthread_mutex_consistent(&heap->lock);
+    return err == 0;
+}
 
-    }
+static inline void unlock_heap(myheap_t *heap){
+    if(heap->shared) pthread_mutex_unlock(&heap->lock);
+}
 
-    void *prev = curr;
-    while(curr != NULL){
-        //printf("%p, %d\n", curr, get_size(curr));
-        if(get_size(curr) >= get_size(ptr)) break;
-        prev = curr;
-        curr = get_next_in_list(curr);
+// A snapshot file starts with a page holding this, the pages of the
+// default segment follow
+typedef struct {
+    unsigned long magic; // SNAPSHOT_MAGIC plus the size of the heap state
+    char *start; // where the segment was
+    size_t size; // bytes of the segment saved
+    myheap_t heap; // the default heap as it was
+} snapshotT;
+#define SNAPSHOT_MAGIC 0x6d79736e61700000UL
+
+/**
+ * Writes all of the nbytes at buf to fd from offset at on
+ */
+static bool write_fully(int fd, const char *buf, size_t nbytes, off_t at){
+    while(nbytes > 0){
+        ssize_t written = pwrite(fd, buf, nbytes, at);
+        if(written <= 0) return false;
+        buf += written;
+        nbytes -= written;
+        at += written;
     }
-    //printf("b");
-    if(curr != NULL) set_prev_in_list(curr, ptr);
-    set_next_in_list(ptr, curr);
-    if(prev != NULL) set_prev_in_list(ptr, prev);
-    if(prev != NULL) set_next_in_list(prev, ptr);
+    return true;
+}
 
-    /*if(curr != NULL) set_next_in_list(curr,ptr);
-    if(curr != NULL)set_prev_in_list(ptr, curr);
-    else set_prev_in_list(ptr, NULL);
-    if(curr != NULL) set_prev_in_list(ptr, get_prev_in_list(curr));
-    else set_prev_in_list(ptr, NULL);
-    buckets[bucket] = ptr;*/
+/**
+ * Function: mysnapshot
+ * --------------------
+ * Saves the default heap to the file at path, its state and then its
+ * segment, which is all of it as long as it has not spread to other
+ * heaps. A heap that has chained further segments, made a long-lived
+ * heap, or handed out handles is not saved.
+ */
+bool mysnapshot(const char *path)
+{
+    myheap_t *heap = &default_heap;
+    if(heap->segment == NULL || heap->overflow != NULL || heap->long_lived != NULL ||
+            heap->handles_used != 0 || sizeof(snapshotT) > PAGE_SIZE) return false;
+    int fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if(fd == -1) return false;
+    snapshotT snap = {SNAPSHOT_MAGIC + sizeof(myheap_t), heap->segment->start, heap->segment->size, *heap};
+    bool ok = write_fully(fd, (char *)&snap, sizeof(snap), 0) &&
+        write_fully(fd, heap->segment->start, heap->segment->size, PAGE_SIZE);
+    return close(fd) == 0 && ok;
+}
 
+/**
+ * Function: myrestore
+ * -------------------
+ * Puts the default heap back as saved in the file at path, in place of
+ * what it holds now. The saved pages are mapped privately over a fresh
+ * default segment, so they are only read in as they are touched and the
+ * file does not change. The heap state is taken from the file apart from
+ * what belongs to this process, the side segments and the roots, and the
+ * heap is reattached if the segment did not land where it was. The heap
+ * held now is only discarded once the file has been mapped and the side
+ * segments of the free index or bitmap have been reserved.
+ */
+bool myrestore(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if(fd == -1) return false;
+    snapshotT snap;
+    if(pread(fd, &snap, sizeof(snap), 0) != sizeof(snap) || snap.magic != SNAPSHOT_MAGIC + sizeof(myheap_t)){
+        close(fd);
+        return false;
+    }
+    // the file is mapped before the heap is given up, so a bad file leaves it as it was
+    segment_t staged = {0};
+    char *start = segment_load(&staged, fd, PAGE_SIZE, snap.size);
+    myheap_t *heap = &default_heap;
+    // and the side segments are had, so that rebuilding them below cannot fail
+    bool sides = start != NULL;
+#ifdef FREE_INDEX
+    sides = sides && init_index(heap);
+#endif
+#ifdef FREE_BITMAP
+    sides = sides && init_bitmap(heap);
+#endif
+    if(!sides){
+        segment_release(&staged);
+        close(fd);
+        return false;
+    }
+    myheap_destroy(heap->long_lived);
+    myheap_destroy(heap->overflow);
+    heap->segment = default_segment();
+    // mapped again where the old segment was, which is usually where it was
+    // saved from and spares reattach a walk over the blocks
+    char *again = segment_load(heap->segment, fd, PAGE_SIZE, snap.size);
+    close(fd);
+    if(again != NULL){
+        segment_release(&staged);
+        start = again;
+    } else {
+        *heap->segment = staged;
+    }
+    myheap_t now = *heap;
+    *heap = snap.heap;
+    // the counters start over, as they do for myinit
+    memset(&heap->stats, 0, sizeof(heap->stats));
+    heap->segment = now.segment;
+    heap->own_segment = now.own_segment;
+    heap->long_lived = NULL;
+    heap->overflow = NULL;
+    heap->handles = now.handles;
+    memcpy(heap->roots, now.roots, sizeof(now.roots));
+    heap->nroots = now.nroots;
+#ifdef FREE_INDEX
+    memcpy(heap->bucket_index, now.bucket_index, sizeof(now.bucket_index));
+#endif
+#ifdef FREE_BITMAP
+    heap->free_bitmap = now.free_bitmap;
+    init_bitmap(heap); // only clears it, it was reserved above
+#endif
+    return reattach(heap, start - snap.start);
 }
 
 /**
- * Taking in a pointer of a previously allocated block this method will
- * either use a free block above to extend the payload, or will run 
- * into my malloc to find the next free-block available to resize,
- * the date will be copied over from the old block.
+ * Function: myheap_sync
+ * ---------------------
+ * Writes a heap file out and waits for it to get to the disk.
  */
-void *myrealloc(void *oldptr, size_t newsz)
-{        
-    unsigned int oldsz = get_size(oldptr);
-        //(hdr_for_payload(oldptr)->payloadsz)&SIZE_MASK; 
-    unsigned int new_size = roundup((unsigned int)newsz, ALIGNMENT); 
-    if(new_size == oldsz) return oldptr;
-    if(new_size < 16) new_size = 16; 
-    // if the next is free, use it
-    if((oldsz < new_size) && has_next_free(oldptr)&& (oldptr < max_block)){
-        // get next block
-        unsigned int nextsz = get_size(payload_for_hdr(get_next(oldptr)));
-        void *next_block = payload_for_hdr(get_next(oldptr));
-        int leftover = nextsz + oldsz - new_size;
-        // if enough space for a free
-        if(leftover >= (int)(2*sizeof(void *))){
-                // remove from free-list
-                int bucket = cal_bucket(nextsz);
-                remove_from_list(next_block, bucket);
-                // set the remaining blocks data
-                void *remainder = (char *)oldptr + new_size;
-                remainder = payload_for_hdr(remainder);
-                set_payload_size(remainder,(oldsz + nextsz - new_size));
-                set_prevpayload_size(remainder, (unsigned int)new_size); 
-                (hdr_for_payload(remainder))->payloadsz |= (get_payloadsz(next_block)&NEXT_FREE);
-                // remember new size and flags
-                (hdr_for_payload(oldptr))->payloadsz = (((unsigned int)new_size|NEXT_FREE) 
-                        | (get_payloadsz(oldptr)&PREV_FREE));
-                // set the prev size of block above
-                if(remainder <  max_block){ 
-                    void* next = payload_for_hdr(get_next(remainder));
-                    set_prevpayload_size(next, get_size(remainder));
-                }
-                if(remainder > max_block) max_block = remainder;             
-                myfree(remainder); 
-                return oldptr;
-        }
-    } 
-    // next cannot accomodate
-    void *newptr = mymalloc(new_size); 
-    memmove(newptr, oldptr, oldsz < new_size ? oldsz: new_size);
-    myfree(oldptr);
-    return newptr;
+bool myheap_sync(myheap_t *heap)
+{
+    return segment_sync(heap->segment);
 }
 
 /**
- * Function: validate_heap
- * -----------------------
- * Prints all of the blocks in the heap, including the free, next free
- * and prev free flags, as well as the size, the previous blocks size,
- * and the address of each block.
+ * Function: myheap_close
+ * ----------------------
+ * Writes a heap file out and unmaps it, the heap can be opened again from
+ * the file with everything in it as it was left.
  */
-bool validate_heap()
+bool myheap_close(myheap_t *heap)
+{
+    if(heap == NULL) return true;
+    bool ok = myheap_sync(heap);
+    myheap_destroy(heap);
+    return ok;
+}
+
+void myheap_set_root(myheap_t *heap, void *root)
+{
+    heap->root = root;
+}
+
+void *myheap_root(myheap_t *heap)
+{
+    return heap->root;
+}
+
+size_t myheap_offset(myheap_t *heap, void *ptr)
+{
+    return ptr == NULL ? 0 : (size_t)((char *)ptr - (char *)heap->segment->start);
+}
+
+void *myheap_pointer(myheap_t *heap, size_t offset)
 {
-    // prints all of the blocks in the heap, with their flags
-    /*void *ptra = min_block;
-    printf("\n\nSTART:\n");
-    while(ptra <= max_block){
-        printf("Address: %p, payloadsz %d and prevpayload: %d ", ptra, 
-                (hdr_for_payload(ptra))->payloadsz&SIZE_MASK, 
-                ((hdr_for_payload(ptra))->prevpayloadsz)&SIZE_MASK);
-        // print free flags
-        if(((hdr_for_payload(ptra))->payloadsz&FREE_MASK) != 0) printf(" F ");
-        else{ printf(" !F ");}
-        // print next free flags
-        if(((hdr_for_payload(ptra))->payloadsz&NEXT_FREE) != 0) printf(" NF ");
-        else printf(" !NF ");
-        // print prev free flags
-        if(((hdr_for_payload(ptra))->payloadsz&PREV_FREE) != 0) printf(" PF ");
-        else printf(" !PF ");
-        printf("\n");
-        ptra = get_next(ptra);
-        ptra = payload_for_hdr(ptra);
-    }*/
-
-  return true;
+    return offset == 0 ? NULL : (char *)heap->segment->start + offset;
 }
 
+/**
+ * Function: get_free_space
+ * ------------------------
+ * Searches through the free-list given by bucket initially to find a free space 
+ * large enough for the requested size, if no space is found goes up the buckets 
+ * to find any space that can fit, retuns a space if available else returns NULL
+ * in which case a new page is required. The block is left on its list.
+ */
+#ifdef FREE_INDEX
+static inline void *get_free_space(myheap_t *heap, int bucket, int* bucketNo,  size_t requestedsz){
+    // start at the bucket and take the smallest (or first) entry that fits
+    for (int i = bucket; i < NUM_BUCKETS; i++){
+        indexT *entries = heap->bucket_index[i];
+        unsigned int best = UINT_MAX, best_size = UINT_MAX;
+        for (unsigned int j = 0; j < heap->bucket_len[i]; j++){
+            unsigned int size = entries[j].size;
+            if(size >= requestedsz && size < best_size){
+                best = j;
+                best_size = size;
+                if(!BEST_FIT || size == requestedsz) break;
+            }
+        }
+        if(best != UINT_MAX){
+            *bucketNo = i;
+            return block_at(heap, entries[best]);
+        }
+    }
+    //return NULL if there is not a large enough block
+    return NULL;
+}
+#else
+static inline void *get_free_space(myheap_t *heap, int bucket, int* bucketNo,  size_t requestedsz){
+    // start at the bucket and iterate through until right size is found
+    for (int i = bucket; i < NUM_BUCKETS; i++){
+        void *best = NULL;
+        void *curr = heap->buckets[i]; 
+        while(curr != NULL){
+            if(get_size(curr) >= requestedsz && 
+                    (best == NULL || get_size(curr) < get_size(best))){ 
+                best = curr;
+                // in a sorted list the first fit is the smallest one
+                if(!BEST_FIT || SORTED_LISTS || get_size(curr) == requestedsz) break;
+            }
+            curr = get_next_in_list(curr);
+        }  
+        if(best != NULL){
+            *bucketNo = i;
+            return best;
+        }
+    }
+    //return NULL if there is not a large enough block
+    return NULL;
+}
+#endif
+
+static void free_block(myheap_t *heap, void *ptr);
+
+/**
+ * Function: place
+ * ---------------
+ * Shrinks the allocated block to requestedsz bytes of payload. If the
+ * leftover space is at least SPLIT_MIN bytes (enough for a header) it is
+ * split off into a block of its own and handed to myheap_free, which coalesces
+ * it with the block above and lists it (or leaves it as garbage when it is
+ * too small for the list). A smaller leftover stays part of the block.
+ */
+static void place(myheap_t *heap, void *block, unsigned int requestedsz){
+    unsigned int remaining_size = get_size(block) - requestedsz;
+    // perfect fit
+    if(remaining_size < SPLIT_MIN) return;
+    // split off the remainder
+    void *remainder = payload_for_hdr((headerT *)((char *)block + requestedsz));
+    set_payload_size(remainder, remaining_size - sizeof(headerT));
+    set_prevpayload_size(remainder, requestedsz);
+    set_payload_size(block, requestedsz | (get_payloadsz(block)&PREV_FREE));
+    if(block == heap->max_block) heap->max_block = remainder;
+    update_neighbours(heap, remainder);
+    free_block(heap, remainder);
+}
+
+#ifdef SPLIT_HIGH
+/**
+ * Function: resize_in_list
+ * ------------------------
+ * A listed block has shrunk but stays in bucket. Its index entry just
+ * takes the new size, a sorted list only needs relinking if the block
+ * is now smaller than the one in front of it.
+ */
+static inline void resize_in_list(myheap_t *heap, void *block, int bucket){
+#ifdef FREE_INDEX
+    heap->bucket_index[bucket][*(unsigned int *)block].size = get_size(block);
+#else
+    void *prev_free = get_prev_in_list(block);
+    if(SORTED_LISTS && prev_free != NULL && get_size(prev_free) > get_size(block)){
+        remove_from_list(heap, block, bucket);
+        add_to_list(heap, block);
+    }
+#endif
+}
+
+/**
+ * Function: split_high
+ * --------------------
+ * With SPLIT_HIGH, when what is left of a free block after an allocation
+ * still belongs in the same bucket, the allocation is carved from the top
+ * of the block. The free block keeps its header and its place on the list
+ * with only its size updated, instead of being unlinked, split, coalesced
+ * and inserted again. Returns the allocated block.
+ */
+static void *split_high(myheap_t *heap, void *block, unsigned int requestedsz, int bucket){
+    unsigned int remaining_size = get_size(block) - requestedsz - sizeof(headerT);
+    void *curr = payload_for_hdr((headerT *)((char *)block + remaining_size));
+    set_payload_size(curr, requestedsz);
+    set_prevpayload_size(curr, remaining_size);
+    set_payload_size(block, remaining_size | (get_payloadsz(block)&(FREE_MASK|PREV_FREE)));
+    if(block == heap->max_block) heap->max_block = curr;
+    update_neighbours(heap, curr);
+    resize_in_list(heap, block, bucket);
+    heap->stats.high_splits++;
+    return curr;
+}
+#endif
+
+/**
+ * Function: get_new_page
+ * ----------------------
+ * Makes a new page in order to store the requestedsz. If the last block in
+ * the heap is free it is grown instead, so only the missing pages are asked
+ * from the page handler. The new space is carved down to requestedsz by
+ * place. Returns a pointer to the base payload which malloc will return,
+ * or NULL if the heap segment cannot be extended.
+ */
+void *get_new_page(myheap_t *heap, size_t requestedsz){
+    size_t reusable = 0;
+    size_t most_new = requestedsz + (EXTEND_PAGES + 1)*PAGE_SIZE; // most the new pages can add
+    if(is_free(heap->max_block) && get_size(heap->max_block) + most_new <= SIZE_MASK){
+        reusable = get_size(heap->max_block) + sizeof(headerT);
+    }
+    void *old_max = heap->max_block;
+    // the last block is the only one that need not be sized by payload_size,
+    // it is widened by pad if the new page would start off PAYLOAD_ALIGNMENT
+    size_t pad = 0;
+    if(reusable == 0){
+        size_t after = (size_t)old_max + get_size(old_max) + sizeof(headerT);
+        pad = roundup(after, PAYLOAD_ALIGNMENT) - after;
+        if(get_size(old_max) + pad > SIZE_MASK) return NULL;
+    }
+    size_t npages = roundup(requestedsz + sizeof(headerT) + pad - reusable, PAGE_SIZE)/PAGE_SIZE;
+    if(npages < EXTEND_PAGES) npages = EXTEND_PAGES;
+    headerT *header = segment_extend(heap->segment, npages);
+    if(header == NULL) return NULL;
+    if(pad != 0){
+        bool was_free = is_free(old_max);
+        if(was_free) unlink_free(heap, old_max);
+        set_payload_size(old_max, get_payloadsz(old_max) + pad);
+        if(was_free && is_listed(old_max)) add_to_list(heap, old_max);
+    }
+    void *page = payload_for_hdr((headerT *)((char *)header + pad));
+    unsigned int page_size = npages*PAGE_SIZE - sizeof(headerT) - pad;
+    // the new page is now the last block in the heap
+    set_payload_size(page, page_size);
+    set_prevpayload_size(page, get_size(old_max));
+    heap->max_block = page;
+    // grow the free block at the top instead if there is one
+    if(reusable != 0){
+        unlink_free(heap, old_max);
+        heap->max_block = old_max;
+        page = old_max;
+        page_size += reusable;
+    }
+    set_block(heap, page, page_size, false);
+    place(heap, page, requestedsz);
+    return page;
+}
+
+#ifdef QUICK_LISTS
+/**
+ * Returns the quick list that blocks with size bytes of payload go on
+ */
+static inline void **quick_list(myheap_t *heap, unsigned int size){
+    return &heap->quick[(size - MIN_PAYLOAD)/ALIGNMENT];
+}
+
+/**
+ * Function: sweep_quick
+ * ---------------------
+ * Frees up to max_blocks of the blocks held on the quick lists for real,
+ * coalescing each one with its free neighbours and putting the result on
+ * the free-lists. The lists are taken in turn, carrying on from where the
+ * last sweep stopped. Returns the number of blocks swept.
+ */
+static unsigned int sweep_quick(myheap_t *heap, unsigned int max_blocks){
+    unsigned int swept = 0;
+    while(swept < max_blocks && heap->quick_count > 0){
+        void **quick = &heap->quick[heap->sweep_next];
+        void *block = *quick;
+        if(block == NULL){
+            heap->sweep_next = (heap->sweep_next + 1) % NUM_QUICK;
+            continue;
+        }
+        *quick = *(void **)block;
+        heap->quick_count--;
+        free_block(heap, block);
+        swept++;
+    }
+    if(swept > 0) heap->stats.sweeps++;
+    return swept;
+}
+#endif
+
+static void *heap_malloc(myheap_t *heap, size_t requestedsz);
+
+/**
+ * Allocates from the heap chained after heap, making it first if there is
+ * none yet, when heap cannot grow any more. Heaps that are not private to
+ * the process, or that are over a region of the caller's, do not chain.
+ */
+static void *overflow_malloc(myheap_t *heap, size_t requestedsz){
+    if(!private_heap(heap) || heap->own_segment.fixed) return NULL;
+    if(heap->overflow == NULL) heap->overflow = myheap_create();
+    if(heap->overflow == NULL) return NULL;
+    return heap_malloc(heap->overflow, requestedsz);
+}
+
+/**
+ * Function: heap_malloc 
+ * ---------------------
+ * Scans thorugh the explicit segregated freelist in order to find if there is 
+ * a space available for the users requested size, if none is available it 
+ * will call the page manager to ask for more space. Handles all of the extra
+ * space either setting it as usable garbage or free space which is freed by
+ * myfree. Returns a pointer to a space of exact or larger than requested size.
+ */
+static void *heap_malloc(myheap_t *heap, size_t requestedsz)
+{  
+    if(requestedsz == 0 || requestedsz > MAX_REQUEST) return NULL;
+    // align requested sz
+    requestedsz = payload_size(requestedsz);
+#ifdef QUICK_LISTS
+    // a block of this size freed recently is reused as it is
+    if(requestedsz <= QUICK_MAX){
+        void **quick = quick_list(heap, requestedsz);
+        void *block = *quick;
+        if(block != NULL){
+            *quick = *(void **)block;
+            heap->quick_count--;
+            heap->stats.quick_hits++;
+            return block;
+        }
+    }
+#endif
+    // get available space from the list if possible
+    int bucket = cal_bucket((unsigned int)requestedsz);
+    int bucketNo;
+    void *curr = get_free_space(heap, bucket, &bucketNo, requestedsz);
+#ifdef QUICK_LISTS
+    // sweep before growing the heap, what is held may coalesce into a fit
+    if(curr == NULL && heap->quick_count > 0){
+        sweep_quick(heap, SWEEP_STEP);
+        curr = get_free_space(heap, bucket, &bucketNo, requestedsz);
+    }
+#endif
+    // no free space available 
+    if(curr == NULL){
+        curr = get_new_page(heap, requestedsz);
+        if(curr != NULL) return curr;
+#ifdef QUICK_LISTS
+        // the heap cannot grow by that much, sweep all that is held and try again
+        if(heap->quick_count > 0){
+            sweep_quick(heap, UINT_MAX);
+            curr = get_free_space(heap, bucket, &bucketNo, requestedsz);
+            if(curr == NULL && (curr = get_new_page(heap, requestedsz)) != NULL) return curr;
+        }
+#endif
+        if(curr == NULL) return overflow_malloc(heap, requestedsz);
+    }
+#ifdef SPLIT_HIGH
+    // leftover stays in the same bucket, carve from the top
+    unsigned int remaining_size = get_size(curr) - requestedsz;
+    // not from the last block if it may be off PAYLOAD_ALIGNMENT, see get_new_page
+    if(remaining_size >= sizeof(headerT) + 2*sizeof(void*) &&
+            cal_bucket(remaining_size - sizeof(headerT)) == bucketNo &&
+            (PAYLOAD_ALIGNMENT == ALIGNMENT || curr != heap->max_block))
+        return split_high(heap, curr, requestedsz, bucketNo);
+#endif
+    // found in free-list, mark used and give back what is left over
+    remove_from_list(heap, curr, bucketNo);
+    set_block(heap, curr, get_size(curr), false);
+    place(heap, curr, requestedsz);
+    return curr;
+}
+
+/**
+ * Funciton: coalesce
+ * ------------------
+ * Given a pointer to a block that is being freed, coalesce will look up and
+ * down to find if the spaces are free and then will conjoin those spaces to make
+ * larger blocks of space, this will also do garbage clean-up by coalescing 
+ * garbage blocks. The neighbours are taken off their lists, the merged block
+ * is marked free but is not listed, and a pointer to it is returned.
+ */
+void *coalesce(myheap_t *heap, void *ptr) {
+    unsigned int new_size = get_size(ptr);
+    // coalesce up
+    if(has_next_free(heap, ptr) && fits_block(new_size, get_size(next_block(ptr)))) {
+        void *next = next_block(ptr);
+        unlink_free(heap, next);
+        new_size += get_size(next) + sizeof(headerT);
+        // remember max
+        if(next == heap->max_block) heap->max_block = ptr;
+    }
+    // coalesce down
+    if(has_prev_free(heap, ptr) && fits_block(new_size, get_size(get_prev(ptr)))) {
+        void *prev = get_prev(ptr);
+        unlink_free(heap, prev);
+        new_size += get_size(prev) + sizeof(headerT);
+        // remember max
+        if(ptr == heap->max_block) heap->max_block = prev;
+        ptr = prev;
+    }
+    set_block(heap, ptr, new_size, true);
+    return ptr;
+}
+
+/**
+ * Function: free_block
+ * --------------------
+ * Takes a pointer to a block currentluy allocated by the user, will add the
+ * block to the appropriate bucket in the segregated free-list, as well as 
+ * call coalesce to make larger spaces if appplicable. 
+ */
+static void free_block(myheap_t *heap, void *ptr){
+    ptr = coalesce(heap, ptr);
+    if(is_listed(ptr)) add_to_list(heap, ptr);
+}
+
+/**
+ * Function: resize_block
+ * ----------------------
+ * Resizes the allocated block oldptr to new_size bytes of payload without
+ * moving it, shrinking it in place or using a free block above to extend
+ * it. Returns false, leaving the block as it was, if neither is possible.
+ */
+static bool resize_block(myheap_t *heap, void *oldptr, unsigned int new_size)
+{
+    unsigned int oldsz = get_size(oldptr);
+    // shrinking, give back the tail
+    if(new_size <= oldsz){
+        place(heap, oldptr, new_size);
+        return true;
+    }
+    // if the next is free and large enough, use it
+    if(has_next_free(heap, oldptr)){
+        void *next = next_block(oldptr);
+        unsigned int total = oldsz + sizeof(headerT) + get_size(next);
+        if(total >= new_size && fits_block(oldsz, get_size(next))){
+            unlink_free(heap, next);
+            if(next == heap->max_block) heap->max_block = oldptr;
+            set_block(heap, oldptr, total, false);
+            place(heap, oldptr, new_size);
+            return true;
+        }
+    } 
+    return false;
+}
+
+/**
+ * Taking in a pointer of a previously allocated block this method will
+ * resize it in place if it can, or will run into my malloc to find the
+ * next free-block available to resize, the date will be copied over from
+ * the old block.
+ */
+static void *realloc_block(myheap_t *heap, void *oldptr, size_t newsz)
+{        
+    if(newsz == 0){
+        free_block(heap, oldptr);
+        return NULL;
+    }
+    if(newsz > MAX_REQUEST) return NULL;
+    unsigned int oldsz = get_size(oldptr);
+    unsigned int new_size = payload_size(newsz);
+    if(resize_block(heap, oldptr, new_size)) return oldptr;
+    // next cannot accomodate
+    void *newptr = heap_malloc(heap, new_size); 
+    if(newptr == NULL) return NULL;
+    memcpy(newptr, oldptr, oldsz);
+    free_block(heap, oldptr);
+    return newptr;
+}
+
+/**
+ * Returns if block lies within the blocks of heap
+ */
+static inline bool owns(myheap_t *heap, void *block){
+    return (char *)block > heap->heap_base &&
+        (char *)block < (char *)heap->segment->start + heap->segment->size;
+}
+
+/**
+ * Looks through the heaps chained after heap and those of the heap for
+ * long-lived blocks for the one that block came from
+ */
+static myheap_t *find_owner(myheap_t *heap, void *block){
+    for(myheap_t *other = heap->overflow; other != NULL; other = other->overflow){
+        if(owns(other, block)) return other;
+    }
+    for(myheap_t *other = heap->long_lived; other != NULL; other = other->overflow){
+        if(owns(other, block)) return other;
+    }
+    return heap;
+}
+
+/**
+ * Returns the heap that block came from, which is heap itself unless it
+ * has other heaps to go with it
+ */
+static inline myheap_t *owner(myheap_t *heap, void *block){
+    if((heap->long_lived == NULL && heap->overflow == NULL) || owns(heap, block)) return heap;
+    return find_owner(heap, block);
+}
+
+static void heap_free(myheap_t *heap, void *ptr){
+    if(ptr == NULL) return;
+    heap = owner(heap, ptr);
+#ifdef QUICK_LISTS
+    unsigned int size = get_size(ptr);
+    // the last block may be widened by get_new_page, which would move it to another list
+    if(size <= QUICK_MAX && (PAYLOAD_ALIGNMENT == ALIGNMENT || ptr != heap->max_block)){
+        void **quick = quick_list(heap, size);
+        *(void **)ptr = *quick;
+        *quick = ptr;
+        if(++heap->quick_count > QUICK_LIMIT) sweep_quick(heap, SWEEP_STEP);
+        return;
+    }
+#endif
+    free_block(heap, ptr);
+}
+
+/**
+ * Function: heap_free_sized
+ * -------------------------
+ * Same as heap_free, for a block asked for size bytes. Its payload is at
+ * least payload_size(size), so a size above QUICK_MAX settles without the
+ * header that the block is too large for the quick lists. Built with
+ * CHECK_SIZES, a size the block could not have been asked for is reported
+ * and aborts the program, to catch a caller that passes the wrong one.
+ */
+static void heap_free_sized(myheap_t *heap, void *ptr, size_t size){
+    if(ptr == NULL) return;
+#ifdef CHECK_SIZES
+    if(size > MAX_REQUEST || payload_size(size) > get_size(ptr)){
+        fprintf(stderr, "block %p of %u bytes freed as %zu bytes\n", ptr, get_size(ptr), size);
+        abort();
+    }
+#endif
+#ifdef QUICK_LISTS
+    if(size > QUICK_MAX){
+        free_block(owner(heap, ptr), ptr);
+        return;
+    }
+#endif
+    heap_free(heap, ptr);
+}
+
+static void *heap_realloc(myheap_t *heap, void *oldptr, size_t newsz)
+{
+    if(oldptr == NULL) return heap_malloc(heap, newsz);
+    return realloc_block(owner(heap, oldptr), oldptr, newsz);
+}
+
+static bool heap_resize(myheap_t *heap, void *ptr, size_t newsz)
+{
+    if(newsz == 0 || newsz > MAX_REQUEST) return false;
+    unsigned int new_size = payload_size(newsz);
+    return resize_block(owner(heap, ptr), ptr, new_size);
+}
+
+/**
+ * Function: mymalloc_usable_size
+ * ------------------------------
+ * The payload of a block can be larger than the size asked for, when the
+ * size was rounded up or the leftover was too small to split off.
+ */
+size_t mymalloc_usable_size(void *ptr)
+{
+    return ptr == NULL ? 0 : get_size(ptr);
+}
+
+/**
+ * Function: place_high
+ * --------------------
+ * Same as place for a block that is not free, but the leftover space is
+ * split off the bottom of the block, so that the block that is kept ends
+ * where it used to. Returns the kept block.
+ */
+static void *place_high(myheap_t *heap, void *block, unsigned int requestedsz){
+    unsigned int remaining_size = get_size(block) - requestedsz;
+    if(remaining_size < SPLIT_MIN) return block;
+    void *upper = (char *)block + remaining_size;
+    set_payload_size(upper, requestedsz);
+    set_prevpayload_size(upper, remaining_size - sizeof(headerT));
+    set_payload_size(block, (remaining_size - sizeof(headerT)) | (get_payloadsz(block)&PREV_FREE));
+    if(block == heap->max_block) heap->max_block = upper;
+    update_neighbours(heap, upper);
+    free_block(heap, block);
+    return upper;
+}
+
+/**
+ * Function: heap_memalign
+ * -----------------------
+ * Allocates a block with room for the request and enough slack to find a
+ * payload address on the alignment inside it, far enough in that the
+ * space in front of it can hold a block header. That space is split off
+ * the bottom by place_high and freed, then the tail is trimmed by place.
+ */
+static void *heap_memalign(myheap_t *heap, size_t alignment, size_t requestedsz)
+{
+    if(alignment == 0 || (alignment & (alignment-1)) != 0) return NULL;
+    if(alignment <= PAYLOAD_ALIGNMENT) return heap_malloc(heap, requestedsz);
+    if(alignment > MAX_REQUEST/2 || requestedsz == 0 || requestedsz > MAX_REQUEST - alignment - SPLIT_MIN) return NULL;
+    requestedsz = payload_size(requestedsz);
+    char *block = heap_malloc(heap, requestedsz + alignment + SPLIT_MIN);
+    if(block == NULL) return NULL;
+    // the block may come from a heap chained after heap, it is split there
+    heap = owner(heap, block);
+    char *aligned = (char *)roundup((size_t)block, alignment);
+    if(aligned == block) {
+        place(heap, block, requestedsz);
+        return block;
+    }
+    while(aligned - block < SPLIT_MIN) aligned += alignment;
+    void *upper = place_high(heap, block, get_size(block) - (aligned - block));
+    place(heap, upper, requestedsz);
+    return upper;
+}
+
+/**
+ * Function: place_near
+ * --------------------
+ * Looks for room right next to the allocated block near, in a free block
+ * above or below it. The new block is cut from the end of the free block
+ * that touches near. Returns NULL if neither neighbour is free and large
+ * enough.
+ */
+static void *place_near(myheap_t *heap, void *near, unsigned int requestedsz){
+    if(has_next_free(heap, near)){
+        void *next = next_block(near);
+        if(get_size(next) >= requestedsz){
+            unlink_free(heap, next);
+            set_block(heap, next, get_size(next), false);
+            place(heap, next, requestedsz);
+            return next;
+        }
+    }
+    if(has_prev_free(heap, near)){
+        void *prev = get_prev(near);
+        if(get_size(prev) >= requestedsz){
+            unlink_free(heap, prev);
+            set_block(heap, prev, get_size(prev), false);
+            return place_high(heap, prev, requestedsz);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Function: heap_malloc_hint
+ * --------------------------
+ * Blocks hinted to be long-lived are kept apart in a heap of their own,
+ * made the first time one is asked for, so that they do not end up pinned
+ * between short-lived blocks and keep the space around them from being
+ * coalesced. Other blocks come from heap. Within the heap picked, a block
+ * is placed against near when a free neighbour of near has room for it,
+ * and falls back to an ordinary allocation otherwise.
+ */
+static void *heap_malloc_hint(myheap_t *heap, size_t requestedsz, alloc_hint_t hint, void *near)
+{
+    if(hint == ALLOC_LONG_LIVED && private_heap(heap)){
+        if(heap->long_lived == NULL) heap->long_lived = myheap_create();
+        if(heap->long_lived != NULL) heap = heap->long_lived;
+    }
+    if(near != NULL && owns(heap, near) && requestedsz != 0 && requestedsz <= MAX_REQUEST){
+        unsigned int size = payload_size(requestedsz);
+        void *block = place_near(heap, near, size);
+        if(block != NULL) return block;
+    }
+    return heap_malloc(heap, requestedsz);
+}
+
+/**
+ * Function: get_allocstats
+ * ------------------------
+ * Copies out the free-list counters kept since the last myinit.
+ */
+void get_allocstats(allocstats_t *out)
+{
+    *out = default_heap.stats;
+}
+
+/**
+ * Function: trim_heap
+ * -------------------
+ * When the last block of the heap is free and spans more than a page past
+ * the EXTEND_PAGES pages kept for the next growth, the pages above that
+ * are given back to the segment. Returns the number of pages given back.
+ */
+static size_t trim_heap(myheap_t *heap){
+    void *top = heap->max_block;
+    size_t keep = EXTEND_PAGES*PAGE_SIZE;
+    if(!is_free(top) || get_size(top) < keep + PAGE_SIZE) return 0;
+    size_t npages = (get_size(top) - keep)/PAGE_SIZE;
+    if(segment_shrink(heap->segment, npages) == NULL) return 0;
+    unlink_free(heap, top);
+    set_block(heap, top, get_size(top) - npages*PAGE_SIZE, true);
+    // smaller now, it may merge with a free block it was too large for
+    top = coalesce(heap, top);
+    if(is_listed(top)) add_to_list(heap, top);
+    heap->stats.trimmed_pages += npages;
+    return npages;
+}
+
+/**
+ * Returns the time in nanoseconds on a clock that only goes forward
+ */
+static long long now_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * Function: heap_maintain
+ * -----------------------
+ * Does the deferred work in steps of SWEEP_STEP blocks, checking the clock
+ * between steps, so it overruns budget_ns by one step at most. The quick
+ * lists are swept first, as sweeping may free the top of the heap, then
+ * the heap is trimmed. The heaps chained after it, then the heap for
+ * long-lived blocks, get what is left of the budget.
+ */
+static bool heap_maintain(myheap_t *heap, long long budget_ns)
+{
+    long long deadline = now_ns() + budget_ns;
+#ifdef QUICK_LISTS
+    while(heap->quick_count > 0){
+        if(now_ns() >= deadline) return false;
+        sweep_quick(heap, SWEEP_STEP);
+    }
+#endif
+    trim_heap(heap);
+    myheap_t *others[] = {heap->overflow, heap->long_lived};
+    for(int i = 0; i < 2; i++){
+        if(others[i] == NULL) continue;
+        long long left = deadline - now_ns();
+        if(left <= 0 || !heap_maintain(others[i], left)) return false;
+    }
+    return true;
+}
+
+/**
+ * Function: myheap_handle_alloc
+ * -----------------------------
+ * Takes a handle, reusing one given back if there is one, and allocates
+ * its block with room for the pointer back to the handle in front of the
+ * caller's data. The block is marked as a handle block so compaction
+ * knows it can be moved.
+ */
+myhandle_t myheap_handle_alloc(myheap_t *heap, size_t requestedsz)
+{
+    if(requestedsz == 0 || requestedsz > MAX_REQUEST - sizeof(void *)) return NULL;
+    if(!private_heap(heap)) return NULL; // the table is not kept in the segment
+    if(heap->handles == NULL){
+        heap->handles = reserve_side_segment(MAX_HANDLES*sizeof(struct myhandle));
+        if(heap->handles == NULL) return NULL;
+    }
+    if(heap->free_handles == NULL && heap->handles_used == MAX_HANDLES) return NULL;
+    void *block = heap_malloc(heap, requestedsz + sizeof(void *));
+    if(block == NULL) return NULL;
+    struct myhandle *handle = heap->free_handles;
+    if(handle != NULL) heap->free_handles = handle->block;
+    else handle = &heap->handles[heap->handles_used++];
+    handle->block = block;
+    handle->locks = 0;
+    *(struct myhandle **)block = handle;
+    hdr_for_payload(block)->payloadsz |= HANDLE_BLOCK;
+    return handle;
+}
+
+/**
+ * Function: myheap_handle_free
+ * ----------------------------
+ * Frees the block of handle as an ordinary block and gives the handle
+ * back to the table.
+ */
+void myheap_handle_free(myheap_t *heap, myhandle_t handle)
+{
+    if(handle == NULL) return;
+    void *block = handle->block;
+    hdr_for_payload(block)->payloadsz &= ~HANDLE_BLOCK;
+    heap_free(heap, block);
+    handle->block = heap->free_handles;
+    heap->free_handles = handle;
+}
+
+void *myhandle_lock(myhandle_t handle)
+{
+    handle->locks++;
+    return (char *)handle->block + sizeof(void *);
+}
+
+void myhandle_unlock(myhandle_t handle)
+{
+    handle->locks--;
+}
+
+/**
+ * Returns if block can be moved by compaction, which it can when it
+ * belongs to a handle that is not locked
+ */
+static inline bool is_movable(void *block){
+    return (get_payloadsz(block) & HANDLE_BLOCK) != 0 &&
+        (*(struct myhandle **)block)->locks == 0;
+}
+
+/**
+ * Function: myheap_compact
+ * ------------------------
+ * Walks the heap from min_block up, gathering the free space met into a
+ * gap that unlocked handle blocks slide down into, each handle being
+ * pointed at the new place of its block. A block that cannot move closes
+ * the gap into a free block in front of it, and whatever gap is left at
+ * the end becomes one free block at the top. The free blocks are then
+ * relisted and the heap is trimmed. Held quick list blocks are swept first. Unlike the
+ * other calls this touches every block of the heap, it is meant for when
+ * the program can afford a pause. Returns the number of blocks moved.
+ */
+size_t myheap_compact(myheap_t *heap)
+{
+    if(heap->shared) return 0;
+    size_t moved = heap->overflow != NULL ? myheap_compact(heap->overflow) : 0;
+#ifdef QUICK_LISTS
+    sweep_quick(heap, UINT_MAX);
+#endif
+    clear_buckets(heap);
+    char *gap = NULL; // where the header of the next block down goes
+    void *top = heap->max_block;
+    for(void *curr = heap->min_block; ; ){
+        bool last = curr == heap->max_block;
+        void *next = last ? NULL : next_block(curr);
+        unsigned int size = get_size(curr);
+        if(is_free(curr)){
+            if(gap == NULL) gap = (char *)hdr_for_payload(curr);
+        } else if(gap != NULL && is_movable(curr)){
+            void *dest = payload_for_hdr((headerT *)gap);
+            memmove(dest, curr, size);
+            // the old last block may end off PAYLOAD_ALIGNMENT, pad it to keep the gap on it
+            size = payload_size(size);
+            set_payload_size(dest, size | HANDLE_BLOCK);
+            (*(struct myhandle **)dest)->block = dest;
+            gap = (char *)dest + size;
+            moved++;
+        } else if(gap != NULL){
+            free_run(payload_for_hdr((headerT *)gap), (char *)hdr_for_payload(curr));
+            gap = NULL;
+        }
+        if(last) break;
+        curr = next;
+    }
+    if(gap != NULL){
+        char *end = (char *)heap->segment->start + heap->segment->size;
+        top = free_run(payload_for_hdr((headerT *)gap), end);
+    }
+    heap->max_block = top;
+    relist_blocks(heap);
+    trim_heap(heap);
+    return moved;
+}
+
+/**
+ * Function: myheap_add_root
+ * -------------------------
+ * Registers the len bytes at start as a root for the collector of heap.
+ * Returns false if heap has MAX_ROOTS roots already.
+ */
+bool myheap_add_root(myheap_t *heap, void *start, size_t len)
+{
+    if(heap->nroots == MAX_ROOTS) return false;
+    heap->roots[heap->nroots].start = start;
+    heap->roots[heap->nroots].len = len;
+    heap->nroots++;
+    return true;
+}
+
+/**
+ * Function: myheap_remove_root
+ * ----------------------------
+ * Forgets the root registered at start, if there is one.
+ */
+void myheap_remove_root(myheap_t *heap, void *start)
+{
+    for(int i = 0; i < heap->nroots; i++){
+        if(heap->roots[i].start == start){
+            heap->roots[i] = heap->roots[--heap->nroots];
+            return;
+        }
+    }
+}
+
+// The state of one collection. blocks holds the payloads of the allocated
+// blocks in address order, so the block a word points into can be found by
+// binary search, with a mark per block and a stack of the marked blocks
+// still to be scanned.
+typedef struct {
+    void **blocks;
+    unsigned char *marks;
+    size_t *stack;
+    size_t nblocks;
+    size_t depth;
+} markerT;
+
+/**
+ * Returns the position in blocks of the allocated block that ptr points
+ * into, or nblocks if it does not point into one
+ */
+static inline size_t find_block(markerT *m, void *ptr){
+    char *p = ptr;
+    if(m->nblocks == 0 || p < (char *)m->blocks[0]) return m->nblocks;
+    size_t lo = 0, hi = m->nblocks;
+    while(hi - lo > 1){
+        size_t mid = lo + (hi - lo)/2;
+        if((char *)m->blocks[mid] <= p) lo = mid;
+        else hi = mid;
+    }
+    if(p >= (char *)m->blocks[lo] + get_size(m->blocks[lo])) return m->nblocks;
+    return lo;
+}
+
+/**
+ * Marks the block that ptr points into, if it is an allocated block of
+ * the heap being collected, and pushes it to be scanned
+ */
+static inline void mark_word(markerT *m, void *ptr){
+    size_t i = find_block(m, ptr);
+    if(i == m->nblocks || m->marks[i]) return;
+    m->marks[i] = 1;
+    m->stack[m->depth++] = i;
+}
+
+/**
+ * Treats every aligned word of the len bytes at start as a possible
+ * pointer into the heap
+ */
+static void mark_range(markerT *m, void *start, size_t len){
+    void **word = (void **)roundup((size_t)start, sizeof(void *));
+    void **end = (void **)((char *)start + len);
+    for(; word + 1 <= end; word++) mark_word(m, *word);
+}
+
+/**
+ * Marks everything reachable from what has been pushed so far
+ */
+static void mark_all(markerT *m){
+    while(m->depth > 0){
+        void *block = m->blocks[m->stack[--m->depth]];
+        mark_range(m, block, get_size(block));
+    }
+}
+
+static int compare_addresses(const void *a, const void *b){
+    char *x = *(char **)a, *y = *(char **)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Frees the unmarked blocks of heap in a single walk, which turns each run
+ * of free and unmarked blocks into one free block, then relists the free
+ * blocks. Returns the number of blocks freed.
+ */
+static size_t sweep_unmarked(myheap_t *heap, markerT *m){
+    clear_buckets(heap);
+    size_t freed = 0;
+    void *run = NULL; // first block of the run of free blocks being gathered
+    for(void *curr = heap->min_block; ; ){
+        bool last = curr == heap->max_block;
+        void *next = last ? NULL : next_block(curr);
+        bool dead = is_free(curr);
+        if(!dead && !m->marks[find_block(m, curr)]){
+            dead = true;
+            freed++;
+        }
+        if(dead && run == NULL) run = curr;
+        if(!dead && run != NULL){
+            free_run(run, (char *)hdr_for_payload(curr));
+            run = NULL;
+        }
+        if(last){
+            if(run != NULL) heap->max_block = free_run(run, (char *)curr + get_size(curr));
+            break;
+        }
+        curr = next;
+    }
+    relist_blocks(heap);
+    return freed;
+}
+
+/**
+ * Function: myheap_collect
+ * ------------------------
+ * Frees every allocated block of heap, and of the heaps chained after it,
+ * that cannot be reached from its roots. Words of the roots and of the
+ * blocks reached are taken to be pointers whenever they point into an
+ * allocated block, anywhere in it. Blocks of handles are always kept, as
+ * are the blocks the long-lived companion heap points to. The blocks freed
+ * are not freed one by one, a single walk of each heap turns each run of
+ * free and unreached blocks into one free block and the free lists are
+ * rebuilt after it, as in compaction. Returns the number of blocks freed,
+ * or 0 if the collector's memory could not be had.
+ */
+size_t myheap_collect(myheap_t *heap)
+{
+    if(!private_heap(heap)) return 0; // the roots are in the memory of one process
+    size_t most = 0;
+    for(myheap_t *part = heap; part != NULL; part = part->overflow){
+#ifdef QUICK_LISTS
+        sweep_quick(part, UINT_MAX);
+#endif
+        most += part->segment->size/sizeof(headerT);
+    }
+    size_t nbytes = most*(sizeof(void *) + sizeof(size_t) + 1);
+    char *side = reserve_side_segment(nbytes);
+    if(side == NULL) return 0;
+    markerT m = {(void **)side, NULL, NULL, 0, 0};
+    m.stack = (size_t *)(side + most*sizeof(void *));
+    m.marks = (unsigned char *)(side + most*(sizeof(void *) + sizeof(size_t)));
+    for(myheap_t *part = heap; part != NULL; part = part->overflow){
+        for(void *curr = part->min_block; ; curr = next_block(curr)){
+            if(!is_free(curr)) m.blocks[m.nblocks++] = curr;
+            if(curr == part->max_block) break;
+        }
+    }
+    // each heap is walked in address order, but the heaps need not be
+    if(heap->overflow != NULL) qsort(m.blocks, m.nblocks, sizeof(void *), compare_addresses);
+    for(size_t i = 0; i < m.nblocks; i++){
+        if(get_payloadsz(m.blocks[i]) & HANDLE_BLOCK){
+            m.marks[i] = 1;
+            m.stack[m.depth++] = i;
+        }
+    }
+    for(int i = 0; i < heap->nroots; i++) mark_range(&m, heap->roots[i].start, heap->roots[i].len);
+    for(myheap_t *other = heap->long_lived; other != NULL; other = other->overflow){
+        for(void *curr = other->min_block; ; curr = next_block(curr)){
+            if(!is_free(curr)) mark_range(&m, curr, get_size(curr));
+            if(curr == other->max_block) break;
+        }
+    }
+    mark_all(&m);
+
+    size_t freed = 0;
+    for(myheap_t *part = heap; part != NULL; part = part->overflow) freed += sweep_unmarked(part, &m);
+    release_side_segment(side, nbytes);
+    return freed;
+}
+
+/**
+ * Function: validate_heap
+ * -----------------------
+ * Walks every block in the heap, checking that the sizes and the free flags
+ * each block keeps about its neighbours agree with the neighbours themselves,
+ * that no two free blocks that fit in one are left uncoalesced and that
+ * the heap exactly covers the segment. Then walks the segregated free-lists, checking links
+ * and buckets and that every listed block is a free block of the heap.
+ * Prints what is wrong and returns false on the first problem found.
+ */
+static bool heap_validate(myheap_t *heap)
+{
+    size_t nfree = 0, nlisted = 0;
+    void *prev = NULL;
+    for(void *curr = heap->min_block; ; curr = next_block(curr)){
+        if(prev != NULL){
+            if(get_prev_size(curr) != get_size(prev)){
+                printf("block %p has wrong size for block below\n", curr);
+                return false;
+            }
+            if(has_prev_free(heap, curr) != is_free(prev) || has_next_free(heap, prev) != is_free(curr)){
+                printf("blocks %p and %p have wrong free flags\n", prev, curr);
+                return false;
+            }
+            if(is_free(prev) && is_free(curr) && fits_block(get_size(prev), get_size(curr))){
+                printf("blocks %p and %p are free but not coalesced\n", prev, curr);
+                return false;
+            }
+        }
+#ifdef FREE_BITMAP
+        if(test_free_bit(heap, curr) != is_free(curr)){
+            printf("block %p has the wrong bit in the free bitmap\n", curr);
+            return false;
+        }
+#endif
+        if((get_payloadsz(curr) & HANDLE_BLOCK) && (is_free(curr) ||
+                    (*(struct myhandle **)curr)->block != curr)){
+            printf("handle block %p is not where its handle says\n", curr);
+            return false;
+        }
+        if((size_t)curr % PAYLOAD_ALIGNMENT != 0){
+            printf("block %p is off the payload alignment\n", curr);
+            return false;
+        }
+        if(is_free(curr) && is_listed(curr)) nfree++;
+        if(curr == heap->max_block) break;
+        if((char *)curr > (char *)heap->segment->start + heap->segment->size){
+            printf("block %p is past the end of the heap\n", curr);
+            return false;
+        }
+        prev = curr;
+    }
+    if((char *)heap->max_block + get_size(heap->max_block) != (char *)heap->segment->start + heap->segment->size){
+        printf("last block %p does not end the heap segment\n", heap->max_block);
+        return false;
+    }
+#ifdef FREE_INDEX
+    for(int i = 0; i < NUM_BUCKETS; i++){
+        for(unsigned int j = 0; j < heap->bucket_len[i]; j++){
+            void *curr = block_at(heap, heap->bucket_index[i][j]);
+            if(!is_free(curr) || !is_listed(curr) || cal_bucket(get_size(curr)) != i){
+                printf("block %p does not belong in bucket %d\n", curr, i);
+                return false;
+            }
+            if(heap->bucket_index[i][j].size != get_size(curr) || *(unsigned int *)curr != j){
+                printf("block %p has a stale index entry\n", curr);
+                return false;
+            }
+            nlisted++;
+        }
+    }
+#else
+    for(int i = 0; i < NUM_BUCKETS; i++){
+        void *prev_free = NULL;
+        for(void *curr = heap->buckets[i]; curr != NULL; curr = get_next_in_list(curr)){
+            if(!is_free(curr) || !is_listed(curr) || cal_bucket(get_size(curr)) != i){
+                printf("block %p does not belong in bucket %d\n", curr, i);
+                return false;
+            }
+            if(get_prev_in_list(curr) != prev_free){
+                printf("block %p has a broken free-list link\n", curr);
+                return false;
+            }
+            if(++nlisted > nfree) break;
+            prev_free = curr;
+        }
+    }
+#endif
+    if(nlisted != nfree){
+        printf("%zu blocks listed but %zu free blocks in the heap\n", nlisted, nfree);
+        return false;
+    }
+#ifdef QUICK_LISTS
+    size_t nquick = 0;
+    for(int i = 0; i < NUM_QUICK; i++){
+        for(void *curr = heap->quick[i]; curr != NULL; curr = *(void **)curr){
+            if(is_free(curr) || quick_list(heap, get_size(curr)) != &heap->quick[i]){
+                printf("block %p does not belong on quick list %d\n", curr, i);
+                return false;
+            }
+            if(++nquick > heap->quick_count) break;
+        }
+    }
+    if(nquick != heap->quick_count){
+        printf("%zu blocks on the quick lists but %u counted\n", nquick, heap->quick_count);
+        return false;
+    }
+#endif
+    if(heap->overflow != NULL && !heap_validate(heap->overflow)) return false;
+    if(heap->long_lived != NULL) return heap_validate(heap->long_lived);
+    return true;
+}
+
+/**
+ * The heap interface takes the lock of a shared heap around the work,
+ * other heaps go straight through
+ */
+void *myheap_malloc(myheap_t *heap, size_t requestedsz)
+{
+    if(!lock_heap(heap)) return NULL;
+    void *ptr = heap_malloc(heap, requestedsz);
+    unlock_heap(heap);
+    return ptr;
+}
+
+void myheap_free(myheap_t *heap, void *ptr)
+{
+    if(!lock_heap(heap)) return;
+    heap_free(heap, ptr);
+    unlock_heap(heap);
+}
+
+void *myheap_realloc(myheap_t *heap, void *oldptr, size_t newsz)
+{
+    if(!lock_heap(heap)) return NULL;
+    void *ptr = heap_realloc(heap, oldptr, newsz);
+    unlock_heap(heap);
+    return ptr;
+}
+
+bool myheap_resize(myheap_t *heap, void *ptr, size_t newsz)
+{
+    if(!lock_heap(heap)) return false;
+    bool ok = heap_resize(heap, ptr, newsz);
+    unlock_heap(heap);
+    return ok;
+}
+
+void *myheap_memalign(myheap_t *heap, size_t alignment, size_t requestedsz)
+{
+    if(!lock_heap(heap)) return NULL;
+    void *ptr = heap_memalign(heap, alignment, requestedsz);
+    unlock_heap(heap);
+    return ptr;
+}
+
+void *myheap_malloc_hint(myheap_t *heap, size_t requestedsz, alloc_hint_t hint, void *near)
+{
+    if(!lock_heap(heap)) return NULL;
+    void *ptr = heap_malloc_hint(heap, requestedsz, hint, near);
+    unlock_heap(heap);
+    return ptr;
+}
+
+bool myheap_maintain(myheap_t *heap, long long budget_ns)
+{
+    if(!lock_heap(heap)) return false;
+    bool done = heap_maintain(heap, budget_ns);
+    unlock_heap(heap);
+    return done;
+}
+
+bool myheap_validate(myheap_t *heap)
+{
+    if(!lock_heap(heap)) return false;
+    bool ok = heap_validate(heap);
+    unlock_heap(heap);
+    return ok;
+}
+
+/**
+ * The original interface works on the default heap
+ */
+void *mymalloc(size_t requestedsz)
+{
+    return heap_malloc(&default_heap, requestedsz);
+}
+
+void *myrealloc(void *oldptr, size_t newsz)
+{
+    return heap_realloc(&default_heap, oldptr, newsz);
+}
+
+void myfree(void *ptr)
+{
+    heap_free(&default_heap, ptr);
+}
+
+void myfree_sized(void *ptr, size_t size)
+{
+    heap_free_sized(&default_heap, ptr, size);
+}
+
+myheap_t *myheap_default()
+{
+    return &default_heap;
+}
+
+bool validate_heap()
+{
+    return heap_validate(&default_heap);
+}
+
+void *mymalloc_hint(size_t requestedsz, alloc_hint_t hint, void *near)
+{
+    return heap_malloc_hint(&default_heap, requestedsz, hint, near);
+}
+
+bool myresize(void *ptr, size_t newsz)
+{
+    return heap_resize(&default_heap, ptr, newsz);
+}
+
+void *mymemalign(size_t alignment, size_t requestedsz)
+{
+    return heap_memalign(&default_heap, alignment, requestedsz);
+}
+
+bool mymaintain(long long budget_ns)
+{
+    return heap_maintain(&default_heap, budget_ns);
+}
+
+myhandle_t myhandle_alloc(size_t requestedsz)
+{
+    return myheap_handle_alloc(&default_heap, requestedsz);
+}
+
+void myhandle_free(myhandle_t handle)
+{
+    myheap_handle_free(&default_heap, handle);
+}
+
+size_t mycompact()
+{
+    return myheap_compact(&default_heap);
+}
+
+bool myadd_root(void *start, size_t len)
+{
+    return myheap_add_root(&default_heap, start, len);
+}
+
+void myremove_root(void *start)
+{
+    myheap_remove_root(&default_heap, start);
+}
+
+size_t mycollect()
+{
+    return myheap_collect(&default_heap);
+}
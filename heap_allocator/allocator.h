@@ -2,12 +2,16 @@
  * -----------------
  * Interface file for the custom heap allocator.
  */
-#ifndef _ALLOCATOR_H
-#define _ALLOCATOR_H
+#ifndef _HEAP_ALLOCATOR_H
+#define _HEAP_ALLOCATOR_H
 
 #include <stdbool.h> // for bool
 #include <stddef.h>  // for size_t
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 
 /* Function: myinit
  * ----------------
@@ -20,6 +24,14 @@
  */
 bool myinit(void);
 
+/* Function: myinit_once
+ * ---------------------
+ * Calls myinit unless the default heap has already been set up, so that
+ * code allocating from it lazily does not wipe out a heap the program
+ * set up itself. Returns true if the default heap is ready.
+ */
+bool myinit_once(void);
+
 /* Function: mymalloc
  * ------------------
  * Custom version of malloc.
@@ -41,6 +53,148 @@ void *myrealloc(void *ptr, size_t size);
 void myfree(void *ptr);
 
 
+/* Function: myfree_sized
+ * -----------------------
+ * Same as myfree, for a caller that knows the size the block was asked
+ * for, such as sized operator delete. The size lets the allocator tell
+ * some blocks apart without reading their header, and an allocator built
+ * with CHECK_SIZES aborts on a size the block was not asked for.
+ */
+void myfree_sized(void *ptr, size_t size);
+
+
+/* Function: myresize
+ * ------------------
+ * Resizes the block ptr to size bytes without moving it. Returns false,
+ * leaving the block as it was, if it cannot be done in place.
+ */
+bool myresize(void *ptr, size_t size);
+
+
+/* Function: mymemalign
+ * --------------------
+ * Same as mymalloc, but the block is aligned to alignment, which must be
+ * a power of 2. The block is freed and reallocated as usual.
+ */
+void *mymemalign(size_t alignment, size_t size);
+
+
+/* Function: mymalloc_usable_size
+ * ------------------------------
+ * Returns how many bytes the block ptr can hold, at least the size it was
+ * allocated with.
+ */
+size_t mymalloc_usable_size(void *ptr);
+
+
+/* Type: allocstats_t
+ * ------------------
+ * Counters of the work the allocator did on its free-lists since the
+ * last call to myinit. A relink is a single insertion into or removal
+ * from a free-list.
+ */
+typedef struct {
+    size_t relinks;      // free-list insertions and removals
+    size_t high_splits;  // allocations carved from the top of a block left listed
+    size_t quick_hits;   // allocations served from a quick list
+    size_t sweeps;       // times the quick lists were swept
+    size_t trimmed_pages; // pages given back to the segment by trimming
+} allocstats_t;
+
+
+/* Function: get_allocstats
+ * ------------------------
+ * Fills in stats with the counters kept since the last myinit.
+ */
+void get_allocstats(allocstats_t *stats);
+
+
+/* Function: mymaintain
+ * --------------------
+ * Does deferred work on the heap, such as coalescing held blocks and
+ * giving free pages at the top of the heap back, for about budget_ns
+ * nanoseconds at most. Meant to be called when the program is idle.
+ * Returns true if all of the work is done, false if some is left for
+ * the next call.
+ */
+bool mymaintain(long long budget_ns);
+
+
+/* Type: myhandle_t
+ * ----------------
+ * A handle to a block that the allocator is free to move, so that the
+ * heap can be compacted. The block can only be reached by locking the
+ * handle, and does not move while it is locked.
+ */
+typedef struct myhandle *myhandle_t;
+
+
+/* Functions: myhandle_alloc, myhandle_free
+ * ----------------------------------------
+ * myhandle_alloc allocates a movable block of size bytes and returns its
+ * handle, or NULL if out of memory. myhandle_free frees the block and
+ * the handle.
+ */
+myhandle_t myhandle_alloc(size_t size);
+void myhandle_free(myhandle_t handle);
+
+
+/* Functions: myhandle_lock, myhandle_unlock
+ * -----------------------------------------
+ * myhandle_lock returns the address of the block of handle, which stays
+ * valid until the matching myhandle_unlock. Locks nest.
+ */
+void *myhandle_lock(myhandle_t handle);
+void myhandle_unlock(myhandle_t handle);
+
+
+/* Function: mycompact
+ * -------------------
+ * Slides the unlocked handle blocks down the heap to gather the free
+ * space between them into one block at the top, then gives the free
+ * pages back. Takes time in proportion to the whole heap. Returns the
+ * number of blocks moved.
+ */
+size_t mycompact(void);
+
+
+/* Functions: myadd_root, myremove_root
+ * -------------------------------------
+ * Registers the len bytes at start as a root for mycollect, or forgets
+ * the root registered at start. myadd_root returns false when no more
+ * roots can be registered.
+ */
+bool myadd_root(void *start, size_t len);
+void myremove_root(void *start);
+
+
+/* Function: mycollect
+ * -------------------
+ * Conservative mark-sweep collection. Frees every block that cannot be
+ * reached from the registered roots, following any word that points
+ * into an allocated block. Every block not reachable is freed, whoever
+ * allocated it, so collect only a heap whose users register their roots.
+ * Blocks of handles are never collected. Returns the number of blocks
+ * freed.
+ */
+size_t mycollect(void);
+
+
+/* Functions: mysnapshot, myrestore
+ * ---------------------------------
+ * mysnapshot saves the default heap, its blocks and their contents, to
+ * the file at path. myrestore replaces the default heap with one saved
+ * by mysnapshot, which starts off just as it was saved, blocks still
+ * allocated included, and can be used in place of myinit. Only a heap in
+ * one segment, without a long-lived heap or handles, can be saved. Both
+ * return false on failure. A file that myrestore cannot read or map in
+ * full leaves the heap as it was, past that the heap must be set up again
+ * with myinit.
+ */
+bool mysnapshot(const char *path);
+bool myrestore(const char *path);
+
+
 /* Function: validate_heap
  * -----------------------
  * This is the hook for your heap consistency checker. Returns true
@@ -48,4 +202,192 @@ void myfree(void *ptr);
  */
 bool validate_heap(void);
 
+
+/* Type: myheap_t
+ * --------------
+ * A heap of its own, independent of the default heap used by mymalloc
+ * and the others. Each heap has its own segment reservation, blocks must
+ * be handed back to the heap they came from.
+ */
+typedef struct myheap myheap_t;
+
+
+/* Function: myheap_default
+ * ------------------------
+ * Returns the heap used by mymalloc and the others, so it can be passed
+ * where a heap is expected. It cannot be destroyed.
+ */
+myheap_t *myheap_default(void);
+
+
+/* Function: myheap_create
+ * -----------------------
+ * Makes a new empty heap, or returns NULL if no segment can be reserved
+ * for it. No call to myinit is needed before using it. A heap that fills
+ * its segment, the default heap included, goes on in another segment
+ * chained after it, so heaps are only limited by address space. No block
+ * spans two segments.
+ */
+myheap_t *myheap_create(void);
+
+
+/* Functions: myheap_malloc, myheap_realloc, myheap_free, myheap_resize,
+ *            myheap_memalign
+ * ---------------------------------------------------------------------
+ * Same as mymalloc, myrealloc, myfree, myresize and mymemalign, for
+ * blocks of heap.
+ */
+void *myheap_malloc(myheap_t *heap, size_t size);
+void *myheap_realloc(myheap_t *heap, void *ptr, size_t size);
+void myheap_free(myheap_t *heap, void *ptr);
+bool myheap_resize(myheap_t *heap, void *ptr, size_t size);
+void *myheap_memalign(myheap_t *heap, size_t alignment, size_t size);
+
+
+/* Type: alloc_hint_t
+ * ------------------
+ * What the caller knows about how long a block will live.
+ */
+typedef enum {
+    ALLOC_NO_HINT,      // nothing known, same as mymalloc
+    ALLOC_SHORT_LIVED,  // freed soon, kept with the unhinted blocks
+    ALLOC_LONG_LIVED    // lives long, kept apart from the other blocks
+} alloc_hint_t;
+
+
+/* Functions: mymalloc_hint, myheap_malloc_hint
+ * --------------------------------------------
+ * Same as mymalloc and myheap_malloc, with hints about the block. Blocks
+ * hinted to be long-lived go to a separate region of the heap so they do
+ * not fragment the space freed by other blocks. If near is not NULL, it
+ * is a block of the same region the new block should be placed next to if
+ * there is room. Blocks are freed and reallocated as usual.
+ */
+void *mymalloc_hint(size_t size, alloc_hint_t hint, void *near);
+void *myheap_malloc_hint(myheap_t *heap, size_t size, alloc_hint_t hint, void *near);
+
+
+/* Function: myheap_maintain
+ * -------------------------
+ * Same as mymaintain, for heap.
+ */
+bool myheap_maintain(myheap_t *heap, long long budget_ns);
+
+
+/* Functions: myheap_handle_alloc, myheap_handle_free, myheap_compact
+ * ------------------------------------------------------------------
+ * Same as myhandle_alloc, myhandle_free and mycompact, for heap.
+ */
+myhandle_t myheap_handle_alloc(myheap_t *heap, size_t size);
+void myheap_handle_free(myheap_t *heap, myhandle_t handle);
+size_t myheap_compact(myheap_t *heap);
+
+
+/* Functions: myheap_add_root, myheap_remove_root, myheap_collect
+ * --------------------------------------------------------------
+ * Same as myadd_root, myremove_root and mycollect, for heap. Roots are
+ * kept per heap. The blocks of the long-lived companion of heap are
+ * scanned as roots, but are not collected themselves.
+ */
+bool myheap_add_root(myheap_t *heap, void *start, size_t len);
+void myheap_remove_root(myheap_t *heap, void *start);
+size_t myheap_collect(myheap_t *heap);
+
+
+/* Function: myheap_init_in
+ * -------------------------
+ * Makes a heap over the len bytes at base, memory the caller owns such as
+ * a static or stack buffer, with no system calls. The heap state takes the
+ * first bytes of the region and blocks are carved from the rest, which
+ * never grows, so allocations fail once the region is full. The region
+ * must outlive the heap. myheap_destroy leaves the region alone and is
+ * only needed in builds with FREE_INDEX or FREE_BITMAP, or once handles
+ * or the long-lived hint have been used, as these reserve memory outside
+ * the region. Returns NULL if len is too small to hold a heap.
+ */
+myheap_t *myheap_init_in(void *base, size_t len);
+
+
+/* Function: myheap_open
+ * ----------------------
+ * Opens the heap kept in the file at path, making a new empty heap there
+ * if the file is empty or does not exist. Blocks allocated in the heap
+ * stay in the file when it is closed and are all there when it is opened
+ * again. The file usually maps back to the same address, but pointers
+ * stored in blocks should be kept as offsets from myheap_offset if the
+ * heap must survive being moved. Handles and the long-lived hint are not
+ * supported by a heap file. Returns NULL if the file cannot be opened,
+ * is in use, or was not made by this allocator with the same policies.
+ */
+myheap_t *myheap_open(const char *path);
+
+
+/* Function: myheap_open_shared
+ * -----------------------------
+ * Opens the heap kept in the POSIX shared memory object name, making a
+ * new empty heap there if there is none. Every process that opens it
+ * sees the same heap at the same address, so a block allocated by one can
+ * be used and freed by another. The calls on the heap take turns through
+ * a process-shared mutex in it, a call that cannot take the mutex fails
+ * as if out of memory and myheap_free leaves the block allocated. Each
+ * process detaches with myheap_destroy, the heap stays in the object until
+ * it is removed with shm_unlink. A child forked after the heap was opened
+ * has it mapped already and uses the pointer it inherited, opening it
+ * again in the child returns NULL as the address is taken. Returns NULL
+ * if the object cannot be opened, was not set up by this allocator with
+ * the same policies, cannot be mapped at the address of the heap in it,
+ * or in a build with FREE_INDEX or FREE_BITMAP. Handles, collection,
+ * compaction and the long-lived hint are not supported by a shared heap.
+ */
+myheap_t *myheap_open_shared(const char *name);
+
+
+/* Functions: myheap_sync, myheap_close
+ * ------------------------------------
+ * myheap_sync writes the heap file of heap out to disk. myheap_close
+ * does the same, then unmaps and closes the file. Both return false if
+ * the heap could not be written. myheap_destroy on a heap file closes it
+ * without waiting for it to be written.
+ */
+bool myheap_sync(myheap_t *heap);
+bool myheap_close(myheap_t *heap);
+
+
+/* Functions: myheap_set_root, myheap_root
+ * ---------------------------------------
+ * The root of a heap file is the one pointer kept for the program, to
+ * find its data again after reopening the heap. It is moved along with
+ * the heap.
+ */
+void myheap_set_root(myheap_t *heap, void *root);
+void *myheap_root(myheap_t *heap);
+
+
+/* Functions: myheap_offset, myheap_pointer
+ * ----------------------------------------
+ * Convert between a pointer into heap and its offset from the start of
+ * the heap, which stays the same wherever the heap is mapped. NULL and
+ * offset 0 convert to each other.
+ */
+size_t myheap_offset(myheap_t *heap, void *ptr);
+void *myheap_pointer(myheap_t *heap, size_t offset);
+
+
+/* Function: myheap_destroy
+ * ------------------------
+ * Releases heap and all of its blocks at once, whether freed or not.
+ */
+void myheap_destroy(myheap_t *heap);
+
+
+/* Function: myheap_validate
+ * -------------------------
+ * Same as validate_heap, for heap.
+ */
+bool myheap_validate(myheap_t *heap);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
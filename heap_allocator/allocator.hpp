@@ -0,0 +1,217 @@
+/* File: allocator.hpp
+ * -------------------
+ * C++ adapters for the heap allocator. Provides std::pmr memory resources
+ * over a heap or an arena, an allocator template for the standard
+ * containers, and optionally replacements for the global operator new and
+ * operator delete.
+ *
+ * Everything here that allocates from the default heap sets it up on first
+ * use, unless the program already has, so no call to myinit is needed.
+ *
+ * The replacements must be compiled into exactly one translation unit of
+ * the program, by defining MYALLOC_REPLACE_NEW before including this file
+ * there. Their first allocation may come before main, so the program must
+ * not call myinit itself, which would discard every block already handed
+ * out. They ask the heap for __STDCPP_DEFAULT_NEW_ALIGNMENT__, 16 bytes on
+ * 64-bit targets, which costs a padded split on every call unless the
+ * allocator is built with payloads on 16 bytes, as allocator-align16.o is.
+ * Like the rest of the allocator, they are not safe to use from several
+ * threads.
+ */
+#ifndef _ALLOCATOR_HPP
+#define _ALLOCATOR_HPP
+
+#include <cstddef>
+#include <limits>
+#include <memory_resource>
+#include <new>
+#include "allocator.h"
+#include "arena.h"
+
+namespace myalloc {
+
+/* Function: default_heap
+ * ----------------------
+ * Returns the default heap, setting it up on the first call, or NULL if
+ * it cannot be set up.
+ */
+inline myheap_t *default_heap() noexcept
+{
+    return myinit_once() ? myheap_default() : nullptr;
+}
+
+
+/* Function: allocate
+ * ------------------
+ * Allocates size bytes aligned to alignment from heap, throwing
+ * std::bad_alloc if the heap is out of memory or NULL.
+ */
+inline void *allocate(myheap_t *heap, std::size_t size, std::size_t alignment)
+{
+    if (heap == nullptr) throw std::bad_alloc();
+    if (size == 0) size = 1;
+    void *ptr = myheap_memalign(heap, alignment, size);
+    if (ptr == nullptr) throw std::bad_alloc();
+    return ptr;
+}
+
+
+/* Class: heap_resource
+ * --------------------
+ * A memory resource that allocates from a heap, the default heap unless
+ * another is given. The heap must outlive the resource.
+ */
+class heap_resource : public std::pmr::memory_resource {
+public:
+    heap_resource() noexcept : heap_(default_heap()) {}
+    explicit heap_resource(myheap_t *heap) noexcept : heap_(heap) {}
+
+    myheap_t *heap() const noexcept { return heap_; }
+
+private:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        return myalloc::allocate(heap_, bytes, alignment);
+    }
+
+    void do_deallocate(void *ptr, std::size_t, std::size_t) override
+    {
+        myheap_free(heap_, ptr);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        const heap_resource *same = dynamic_cast<const heap_resource *>(&other);
+        return same != nullptr && same->heap_ == heap_;
+    }
+
+    myheap_t *heap_;
+};
+
+
+/* Class: arena_resource
+ * ---------------------
+ * A memory resource that allocates from an arena. Deallocation does
+ * nothing, the memory comes back when the arena is reset or released.
+ * The arena must outlive the resource.
+ */
+class arena_resource : public std::pmr::memory_resource {
+public:
+    explicit arena_resource(arena_t *arena) noexcept : arena_(arena) {}
+
+    arena_t *arena() const noexcept { return arena_; }
+
+private:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        // arenas align to ARENA_ALIGNMENT, ask for slack to align further
+        std::size_t slack = alignment > ARENA_ALIGNMENT ? alignment - ARENA_ALIGNMENT : 0;
+        if (bytes > std::numeric_limits<std::size_t>::max() - slack) throw std::bad_alloc();
+        char *ptr = static_cast<char *>(arena_alloc(arena_, bytes + slack));
+        if (ptr == nullptr) throw std::bad_alloc();
+        std::size_t misalign = reinterpret_cast<std::size_t>(ptr) & (alignment - 1);
+        return misalign == 0 ? ptr : ptr + (alignment - misalign);
+    }
+
+    void do_deallocate(void *, std::size_t, std::size_t) override {}
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        const arena_resource *same = dynamic_cast<const arena_resource *>(&other);
+        return same != nullptr && same->arena_ == arena_;
+    }
+
+    arena_t *arena_;
+};
+
+
+/* Class: allocator
+ * ----------------
+ * An allocator for the standard containers that allocates from the
+ * default heap, e.g. std::vector<int, myalloc::allocator<int>>. All
+ * instances are interchangeable. Deallocation passes the size down.
+ */
+template <class T>
+struct allocator {
+    typedef T value_type;
+
+    allocator() noexcept {}
+    template <class U> allocator(const allocator<U> &) noexcept {}
+
+    T *allocate(std::size_t n)
+    {
+        if (n > std::numeric_limits<std::size_t>::max()/sizeof(T)) throw std::bad_array_new_length();
+        return static_cast<T *>(myalloc::allocate(default_heap(), n*sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *ptr, std::size_t n) noexcept
+    {
+        myfree_sized(ptr, n*sizeof(T));
+    }
+};
+
+template <class T, class U>
+bool operator==(const allocator<T> &, const allocator<U> &) noexcept { return true; }
+template <class T, class U>
+bool operator!=(const allocator<T> &, const allocator<U> &) noexcept { return false; }
+
+} // namespace myalloc
+
+
+#ifdef MYALLOC_REPLACE_NEW
+// Replacements for the global operator new and operator delete, on the
+// default heap. The nothrow forms of new are left to the library, which
+// implements them on top of these.
+
+namespace {
+/* Function: new_block
+ * -------------------
+ * Allocates for operator new. As the standard asks, while the heap is out
+ * of memory the new handler is called to make room, and std::bad_alloc is
+ * only thrown once there is no handler.
+ */
+void *new_block(std::size_t size, std::size_t alignment)
+{
+    if (size == 0) size = 1;
+    while (true) {
+        myheap_t *heap = myalloc::default_heap();
+        void *ptr = heap != nullptr ? myheap_memalign(heap, alignment, size) : nullptr;
+        if (ptr != nullptr) return ptr;
+        std::new_handler handler = std::get_new_handler();
+        if (handler == nullptr) throw std::bad_alloc();
+        handler();
+    }
+}
+}
+
+void *operator new(std::size_t size)
+{
+    return new_block(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void *operator new[](std::size_t size)
+{
+    return new_block(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment)
+{
+    return new_block(size, static_cast<std::size_t>(alignment));
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment)
+{
+    return new_block(size, static_cast<std::size_t>(alignment));
+}
+
+void operator delete(void *ptr) noexcept { myfree(ptr); }
+void operator delete[](void *ptr) noexcept { myfree(ptr); }
+void operator delete(void *ptr, std::size_t size) noexcept { myfree_sized(ptr, size); }
+void operator delete[](void *ptr, std::size_t size) noexcept { myfree_sized(ptr, size); }
+void operator delete(void *ptr, std::align_val_t) noexcept { myfree(ptr); }
+void operator delete[](void *ptr, std::align_val_t) noexcept { myfree(ptr); }
+void operator delete(void *ptr, std::size_t size, std::align_val_t) noexcept { myfree_sized(ptr, size); }
+void operator delete[](void *ptr, std::size_t size, std::align_val_t) noexcept { myfree_sized(ptr, size); }
+#endif
+
+#endif
@@ -1,8 +1,8 @@
 /*
  * Files: alloctest.c
  * ------------------
- * Reads and interprets text-based script files containing a sequence of
- * allocator requests. Runs the allocator on the script, validating for
+ * Reads and interprets script files containing a sequence of allocator
+ * requests, text scripts or binary traces (see script.h). Runs the allocator on the script, validating for
  * for correctness and then evaulating allocator's utilization and throughput.
  *
  * jzelenski, updated Wed Nov 19 14:45:18 PST 2014
@@ -19,11 +19,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 #include <valgrind/callgrind.h>
 
 #include "allocator.h"
 #include "fcyc.h"
+#include "fmiss.h"
+#include "script.h"
 #include "segment.h"
 
 // Alignment requirement
@@ -40,29 +43,6 @@
 // This constant is the stable target allocator throughput is ranked against
 #define TARGET_THRUPUT      12000
 
-// struct for a single allocator request
-typedef struct {
-    enum {ALLOC=1, FREE, REALLOC} op;	// type of request
-    int id;		        // id for free() to use later
-    size_t size;        // num bytes for alloc/realloc request
-    int lineno;         // which line in file
-} request_t;
-
-// struct for facts about a single malloc'ed node
-typedef struct {
-    void *ptr;
-    size_t size;
-} block_t;
-
-// struct for info for one script file
-typedef struct {
-    char name[128];		// short name of script
-    request_t *ops;	    // array of requests read from script
-    int num_ops;		// number of requests
-    int num_ids;		// number of distinct block ids
-    block_t *blocks;    // array of blocks returned by malloc when executing
-} script_t;
-
 // packs the params to the speed function to be timed by fcyc.
 // timed function must take single void * client data pointer
 typedef struct {
@@ -73,26 +53,32 @@ typedef struct {
 // Result from executing a script
 typedef struct {
     char name[128];     // short name of script
-    int num_ops;		// number of ops (malloc/free/realloc) in script
+    long num_ops;		// number of ops (malloc/free/realloc) in script
     bool valid;		    // was the script processed correctly by the allocator?
     double secs;		// number of secs needed to execute the script
     double utilization;	// mem utilization  (percent of heap storage in use)
     int tput;           // expressed in Kreq/sec
+    double misses;      // cache misses per request, negative if not counted
+    double relinks;     // free-list insertions and removals per request
 } result_t;
 
-typedef enum { Correctness = 1, Performance = 2 } flags_t;
+typedef enum { Correctness = 1, Performance = 2, Misses = 4, Stats = 8, Streaming = 16 } flags_t;
+
+// heap snapshots to start each script from and to save each script's heap to, if any
+static const char *load_path, *save_path;
 
 static void get_scripts(char *path, char files[][PATH_MAX], int max, int *pcount);
-static void parse_script(char *filename, script_t *script);
 static void run_scripts(char paths[][PATH_MAX], int n, flags_t flags);
+static bool start_heap(void);
 static bool eval_correctness(script_t *script);
 static void eval_performance(void *data);
-static bool verify_block(void *ptr, size_t size, script_t *script, int lineno);
-static bool verify_payload(void *ptr, size_t size, int id, script_t *script, int lineno, char *op);
+static void eval_stream(const char *path, result_t *result);
+static bool verify_block(void *ptr, size_t size, script_t *script, long lineno);
+static bool verify_payload(void *ptr, size_t size, int id, script_t *script, long lineno, char *op);
 static void print_table(result_t result[], int n, flags_t which);
 static void usage();
 static void fatal_error(char *format, ...);
-static void allocator_error(script_t *script, int lineno, char* format, ...);
+static void allocator_error(script_t *script, long lineno, char* format, ...);
 static const char *mybasename(const char *path);
 static int cmpbase(const void *one, const void *two);
 static char *endswith(char *str, const char *suffix);
@@ -106,16 +92,31 @@ int main(int argc, char *argv[])
     int nscripts = 0;
 
     CALLGRIND_TOGGLE_COLLECT ;// turn off profiling while we do the setup work, later turn on during simulation
-    while ((c = getopt(argc, argv, "f:pc")) != EOF) {
+    while ((c = getopt(argc, argv, "f:pcmsl:w:t")) != EOF) {
         switch (c) {
             case 'f':
                 get_scripts(optarg, paths, sizeof(paths)/sizeof(paths[0]), &nscripts);
                 break;
             case 'p':
-                flags = Performance;
+                flags = (flags & (Misses|Stats|Streaming)) | Performance;
                 break;
             case 'c':
-                flags = Correctness;
+                flags = (flags & (Misses|Stats)) | Correctness;
+                break;
+            case 'm':
+                flags |= Misses;
+                break;
+            case 's':
+                flags |= Stats;
+                break;
+            case 'l':
+                load_path = optarg;
+                break;
+            case 'w':
+                save_path = optarg;
+                break;
+            case 't':
+                flags = (flags & Stats) | Performance | Streaming;
                 break;
             default:
                 usage();
@@ -152,8 +153,8 @@ static void get_scripts(char *path, char files[][PATH_MAX], int max, int *pcount
     struct dirent *dp;
     int before = *pcount;
     while ((dp = readdir(dirp)) != NULL && *pcount < max) { // read files from dir one-by-one
-        // take all non-hidden files with .script extension
-        if (dp->d_name[0] != '.' && endswith(dp->d_name,".script"))
+        // take all non-hidden files with .script or .trace extension
+        if (dp->d_name[0] != '.' && (endswith(dp->d_name,".script") || endswith(dp->d_name,".trace")))
             sprintf(files[(*pcount)++], "%s/%s", path, dp->d_name);
     }
     closedir(dirp);
@@ -166,6 +167,7 @@ static void get_scripts(char *path, char files[][PATH_MAX], int max, int *pcount
  * Runs a set of scripts against the allocator.  It loops script-by-script.
  * For each script, runs once for correctness (unless flags are perf only)
  * and if had no correctness errors, runs a performance trial on the same script.
+ * Streamed scripts are only run once for performance, see eval_stream.
  * Records results into an array, which is printed at end.
  */
 static void run_scripts(char paths[][PATH_MAX], int n, flags_t which)
@@ -173,131 +175,159 @@ static void run_scripts(char paths[][PATH_MAX], int n, flags_t which)
     result_t result[n];
 
     for (int i = 0; i < n; i++) {
+        if (which & Streaming) {
+            eval_stream(paths[i], &result[i]);
+            continue;
+        }
         script_t script;
-        parse_script(paths[i], &script);
+        if (!load_script(paths[i], &script))
+            fatal_error("Could not load script \"%s\".\n", paths[i]);
         strcpy(result[i].name, script.name);
         result[i].num_ops = script.num_ops;
+        result[i].misses = -1;
         printf("Evaluating allocator on %s....", script.name);
         result[i].valid = !(which & Correctness) || eval_correctness(&script);
         if (result[i].valid && (which & Performance)) {
             perfdata_t pd = {.script = &script, .utilization = &result[i].utilization};
             result[i].secs = fsecs(eval_performance, &pd);
             result[i].tput = result[i].num_ops/(result[i].secs*1e3);
+            allocstats_t stats;
+            get_allocstats(&stats);
+            result[i].relinks = (double)stats.relinks/result[i].num_ops;
+            if (which & Misses) {
+                long long misses = fmisses(eval_performance, &pd);
+                if (misses >= 0) result[i].misses = (double)misses/result[i].num_ops;
+            }
         } else {
             result[i].secs = result[i].utilization = 0;
         }
+        if (save_path && result[i].valid && !mysnapshot(save_path))
+            fatal_error("Could not save the heap to \"%s\".\n", save_path);
         printf("done.\n");
-        free(script.ops);
-        free(script.blocks);
+        unload_script(&script);
     }
     print_table(result, n, which); // display results
 }
 
 
-/* Function: read_line
+/* Function: start_heap
  * --------------------
- * Reads one line from file and stores in buf. Skips lines that are all-white or beginning with
- * comment char #. Increments pass-by-ref counter of number of lines read/skipped. Removes
- * trailing newline. Returns true if did read valid line, false otherwise.
+ * Sets up the heap a script runs on, empty from myinit or restored from the
+ * snapshot given with -l. Blocks restored with the heap stay allocated
+ * throughout, they are not known to the script.
  */
-static bool read_line(char buf[], size_t bufsz, FILE *fp, int *pnread)
+static bool start_heap(void)
 {
-    while (true) {
-        if (fgets(buf, bufsz, fp) == NULL) return false;
-        (*pnread)++;
-        if (buf[strlen(buf)-1] == '\n') buf[strlen(buf)-1] ='\0'; // remove trailing newline
-        char ch;
-        if (sscanf(buf, " %c", &ch) == 1 && ch != '#') // scan first non-white char, check not #
-            return true;
-    }
+    return load_path ? myrestore(load_path) : myinit();
 }
 
 
-/*
- * Fuction: parse_script
- * ---------------------
- * Parse a script file and store sequence of requests for later execution.
+// What the timed trials track of the memory in use, for utilization
+typedef struct {
+    size_t cur_payload_size;    // payload of the script's blocks now
+    size_t peak_payload_size;   // payload when the segment was last at its peak
+    size_t max_segment_size;    // peak size of the heap segment
+    size_t start_size;          // size of the segment when the script started
+} usage_t;
+
+
+/* Function: replay_request
+ * ------------------------
+ * Carries out req on blocks with no checking, touching both ends of each
+ * block it gets so that the timed trials pay for reaching them, and updates
+ * usage. Shared by eval_performance and eval_stream, which keep their
+ * blocks by id and by slot.
  */
-static void parse_script(char *path, script_t *script)
+static inline void replay_request(const request_t *req, block_t *blocks, usage_t *usage)
 {
-    FILE *fp = fopen(path, "r");
-    if (fp == NULL)
-        fatal_error("Could not open script file \"%s\".\n", path);
+    int id = req->id;
+    size_t requested_size = req->size;
+
+    switch (req->op) {
+
+        case ALLOC:
+            blocks[id].ptr = mymalloc(requested_size);
+            blocks[id].size = requested_size;
+            usage->cur_payload_size += requested_size;
+            if (requested_size) ((char *)blocks[id].ptr)[0] = ((char *)blocks[id].ptr)[requested_size-1] = 0xab;
+            break;
+
+        case REALLOC:
+            blocks[id].ptr = myrealloc(blocks[id].ptr, requested_size);
+            usage->cur_payload_size += (requested_size - blocks[id].size);
+            blocks[id].size = requested_size;
+            if (requested_size) ((char *)blocks[id].ptr)[0] = ((char *)blocks[id].ptr)[requested_size-1] = 0xcd;
+            break;
+
+        case FREE:
+            myfree(blocks[id].ptr);
+            usage->cur_payload_size -= blocks[id].size;
+            blocks[id] = (block_t){.ptr = NULL, .size = 0};
+            break;
+    }
 
-    strncpy(script->name, mybasename(path), sizeof(script->name)-1); // copy basename (up to limit)
-    script->name[sizeof(script->name)-1] = '\0';    // null terminate
-    char *ext = endswith(script->name, ".script");   // truncate file extension
-    if (ext) *ext = '\0';
-    script->ops = NULL;
-    script->num_ops = 0;
-    int lineno = 0, nallocated = 0, maxid = 0;
-    char buf[1024];
-
-    for (int i = 0; read_line(buf, sizeof(buf), fp, &lineno) ; i++) {
-        if (i == nallocated) {
-            nallocated += 500;
-            script->ops = realloc(script->ops, nallocated*sizeof(request_t));
-            if (!script->ops)
-                fatal_error("Libc heap exhausted. Cannot continue.\n");
-        }
-        script->ops[i].lineno = lineno;
-        char request;
-        script->ops[i].op = script->ops[i].size = 0;
-        int nscanned = sscanf(buf, " %c %d %zu", &request, &script->ops[i].id, &script->ops[i].size);
-        if (request == 'a' && nscanned == 3)
-            script->ops[i].op = ALLOC;
-        else if (request == 'r' && nscanned == 3)
-            script->ops[i].op = REALLOC;
-        else if (request == 'f' && nscanned == 2)
-            script->ops[i].op = FREE;
-        if (!script->ops[i].op || script->ops[i].id < 0 || script->ops[i].size > INT_MAX)
-            fatal_error("Malformed request '%s' line %d of %s\n", buf, lineno, script->name);
-        if (script->ops[i].id > maxid) maxid = script->ops[i].id;
-        script->num_ops = i+1;
+    // peak util is ratio of inuse/segment, reset when either changes (numerator or denom)
+    if (heap_segment_size() > usage->max_segment_size || usage->cur_payload_size > usage->peak_payload_size) {
+        usage->max_segment_size = heap_segment_size();
+        usage->peak_payload_size = usage->cur_payload_size;
     }
-    fclose(fp);
+}
+
 
-    script->num_ids = maxid + 1;
-    script->blocks = calloc(script->num_ids, sizeof(block_t));
-    if (!script->blocks)
-        fatal_error("Libc heap exhausted. Cannot continue.\n");
+/* Function: peak_utilization
+ * --------------------------
+ * Returns the peak payload over the peak size of the heap segment. On a
+ * heap restored with -l the restored blocks are not the script's, so the
+ * script's payload is set against what the segment grew by while it ran
+ * instead, counted as fully used when the script fit in the space the
+ * restored heap already had.
+ */
+static double peak_utilization(const usage_t *usage)
+{
+    if (!load_path)
+        return usage->max_segment_size ? ((double)usage->peak_payload_size)/usage->max_segment_size : 0;
+    if (usage->max_segment_size <= usage->start_size) return usage->peak_payload_size ? 1 : 0;
+    double used = ((double)usage->peak_payload_size)/(usage->max_segment_size - usage->start_size);
+    return used < 1 ? used : 1;
 }
 
 
 /* Function: eval_correctness
  * --------------------------
- * Check the allocator for correctness on given script. Interprets the earlier parsed
+ * Check the allocator for correctness on given script. Interprets the loaded
  * script operation-by-operation and reports if it detects any "obvious"
  * errors (returning blocks outside the heap, unaligned, overlapping blocks, etc.)
  */
 static bool eval_correctness(script_t *script)
 {
-    if (!myinit()) {
-        allocator_error(script, 0, "myinit() returned false");
+    if (!start_heap()) {
+        allocator_error(script, 0, load_path ? "myrestore() returned false" : "myinit() returned false");
         return false;
     }
     if (!validate_heap()) { // check heap consistency after init
-        allocator_error(script, 0, "validate_heap() returned false, called after myinit");
+        allocator_error(script, 0, "validate_heap() returned false, called after %s", load_path ? "myrestore" : "myinit");
         return false;
     }
     memset(script->blocks, 0, script->num_ids*sizeof(script->blocks[0]));
 
-    for (int req = 0; req < script->num_ops; req++) {
-        int id = script->ops[req].id;
-        size_t requested_size = script->ops[req].size;
+    script_pos_t pos;
+    request_t req;
+    for (script_rewind(script, &pos); script_next(script, &pos, &req); ) {
+        int id = req.id;
+        size_t requested_size = req.size;
         size_t old_size = script->blocks[id].size;
         void *p, *newp, *oldp = script->blocks[id].ptr;
 
-        switch (script->ops[req].op) {
+        switch (req.op) {
 
             case ALLOC:
                 if ((p = mymalloc(requested_size)) == NULL && requested_size != 0) {
-                    allocator_error(script, script->ops[req].lineno, "malloc returned NULL");
+                    allocator_error(script, req.lineno, "malloc returned NULL");
                     return false;
                 }
                 // Test new block for correctness: must be properly aligned
                 // and must not overlap any currently allocated block.
-                if (!verify_block(p, requested_size, script, script->ops[req].lineno))
+                if (!verify_block(p, requested_size, script, req.lineno))
                     return false;
 
                 // Fill new block with the low-order byte of new id
@@ -307,21 +337,21 @@ static bool eval_correctness(script_t *script)
                 break;
 
             case REALLOC:
-                if (!verify_payload(oldp, old_size, id, script, script->ops[req].lineno, "realloc-ing"))
+                if (!verify_payload(oldp, old_size, id, script, req.lineno, "realloc-ing"))
                     return false;
                 if ((newp = myrealloc(oldp, requested_size)) == NULL && requested_size != 0) {
-                    allocator_error(script, script->ops[req].lineno, "realloc returned NULL");
+                    allocator_error(script, req.lineno, "realloc returned NULL");
                     return false;
                 }
 
                 old_size = script->blocks[id].size;
                 script->blocks[id].size = 0;
-                if (!verify_block(newp, requested_size, script, script->ops[req].lineno))
+                if (!verify_block(newp, requested_size, script, req.lineno))
                     return false;
                 // Verify new block contains the data from the old block
                 for (size_t j = 0; j < (old_size < requested_size ? old_size : requested_size); j++) {
                     if (*((unsigned char *)newp + j) != (id & 0xFF)) {
-                        allocator_error(script, script->ops[req].lineno, "realloc did not preserve the data from old block");
+                        allocator_error(script, req.lineno, "realloc did not preserve the data from old block");
                         return false;
                     }
                 }
@@ -334,7 +364,7 @@ static bool eval_correctness(script_t *script)
                 old_size = script->blocks[id].size;
                 p = script->blocks[id].ptr;
                 // verify payload intact before free
-                if (!verify_payload(p, old_size, id, script, script->ops[req].lineno, "freeing"))
+                if (!verify_payload(p, old_size, id, script, req.lineno, "freeing"))
                     return false;
                 script->blocks[id] = (block_t){.ptr = NULL, .size = 0};
                 myfree(p);
@@ -342,10 +372,12 @@ static bool eval_correctness(script_t *script)
         }
 
         if (!validate_heap()) { // check heap consistency after each request
-            allocator_error(script, script->ops[req].lineno, "validate_heap() returned false, called in-between requests");
+            allocator_error(script, req.lineno, "validate_heap() returned false, called in-between requests");
             return false;   // stop at first sign of error
         }
     }
+    if (pos.index != script->num_ops)
+        fatal_error("Damaged trace at request %ld of %s.\n", pos.index + 1, script->name);
 
     // verify payload is still intact for any block still allocated
     for (int id = 0;  id < script->num_ids;  id++)
@@ -368,53 +400,86 @@ static bool eval_correctness(script_t *script)
 static void eval_performance(void *data)
 {
     perfdata_t *pd = (perfdata_t *)data;
-    size_t peak_payload_size = 0, cur_payload_size = 0, max_segment_size = 0;
     script_t *script = pd->script;
 
-    myinit();
+    if (!start_heap())
+        fatal_error("Could not start the heap for %s.\n", script->name);
+    usage_t usage = {.start_size = heap_segment_size()};
     memset(script->blocks, 0, script->num_ids*sizeof(script->blocks[0]));
 
     CALLGRIND_TOGGLE_COLLECT;	// turn on valgrind profiler here
-    for (int line = 0; line < script->num_ops;  line++) {
-        int id = script->ops[line].id;
-        size_t requested_size = script->ops[line].size;
+    script_pos_t pos;
+    request_t req;
+    for (script_rewind(script, &pos); script_next(script, &pos, &req); )
+        replay_request(&req, script->blocks, &usage);
 
-        switch (script->ops[line].op) {
+    *pd->utilization = peak_utilization(&usage);
+    CALLGRIND_TOGGLE_COLLECT;  // turn off profiler here
+}
 
-            case ALLOC:
-                script->blocks[id].ptr = mymalloc(requested_size);
-                script->blocks[id].size = requested_size;
-                cur_payload_size += requested_size;
-                if (requested_size) ((char *)script->blocks[id].ptr)[0] = ((char *)script->blocks[id].ptr)[requested_size-1] = 0xab;
-                break;
 
-            case REALLOC:
-                script->blocks[id].ptr = myrealloc(script->blocks[id].ptr, requested_size);
-                cur_payload_size += (requested_size - script->blocks[id].size);
-                script->blocks[id].size = requested_size;
-                if (requested_size) ((char *)script->blocks[id].ptr)[0] = ((char *)script->blocks[id].ptr)[requested_size-1] = 0xcd;
-                break;
 
-            case FREE:
-                myfree(script->blocks[id].ptr);
-                cur_payload_size -= script->blocks[id].size;
-                script->blocks[id] = (block_t){.ptr = NULL, .size = 0};
-                break;
+/* Function: eval_stream
+ * ---------------------
+ * Runs a single performance trial on the script at path streamed from the
+ * file, for scripts too large to load (see stream_open in script.h). Like
+ * eval_performance it does no checking and tracks peak utilization. The
+ * trial is timed once rather than by fcyc, which would read the script over
+ * and over, and its time includes any wait for the reader. Blocks are kept
+ * by slot rather than by id, so the table holds as many blocks as are live
+ * at once.
+ */
+static void eval_stream(const char *path, result_t *result)
+{
+    block_t *blocks = NULL;
+    int nblocks = 0;
+
+    script_name(path, result->name, sizeof(result->name));
+    printf("Streaming allocator on %s....", result->name);
+    stream_t *stream = stream_open(path);
+    if (!stream)
+        fatal_error("Could not stream script \"%s\".\n", path);
+    if (!start_heap())
+        fatal_error("Could not start the heap for %s.\n", result->name);
+    usage_t usage = {.start_size = heap_segment_size()};
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    CALLGRIND_TOGGLE_COLLECT;	// turn on valgrind profiler here
+    result->num_ops = 0;
+    batch_t batch = {0};
+    while (stream_next(stream, &batch)) {
+        if (batch.num_slots > nblocks) {
+            int more = batch.num_slots > 2*nblocks ? batch.num_slots : 2*nblocks;
+            if (!(blocks = realloc(blocks, more*sizeof(block_t))))
+                fatal_error("Libc heap exhausted. Cannot continue.\n");
+            memset(blocks + nblocks, 0, (more - nblocks)*sizeof(block_t));
+            nblocks = more;
         }
-
-        // peak util is ratio of inuse/segment, reset when either changes (numerator or denom)
-        if (heap_segment_size() > max_segment_size || (cur_payload_size > peak_payload_size) ) {
-            max_segment_size = heap_segment_size();
-            peak_payload_size = cur_payload_size;
-        } 
-     }
- 
-    *pd->utilization = ((double)peak_payload_size)/max_segment_size;
+        for (long i = 0; i < batch.num_ops; i++)
+            replay_request(&batch.ops[i], blocks, &usage);
+        result->num_ops += batch.num_ops;
+    }
     CALLGRIND_TOGGLE_COLLECT;  // turn off profiler here
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (!stream_close(stream))
+        fatal_error("Could not read script \"%s\" to its end.\n", path);
+    free(blocks);
+
+    result->valid = true;
+    result->misses = -1;
+    result->secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec)/1e9;
+    result->tput = result->secs > 0 ? result->num_ops/(result->secs*1e3) : 0;
+    result->utilization = peak_utilization(&usage);
+    allocstats_t stats;
+    get_allocstats(&stats);
+    result->relinks = result->num_ops ? (double)stats.relinks/result->num_ops : 0;
+    if (save_path && !mysnapshot(save_path))
+        fatal_error("Could not save the heap to \"%s\".\n", save_path);
+    printf("done.\n");
 }
 
 
-
 /* Function: verify_block
  * ----------------------
  * Does some simple checks on the block returned by allocator to try to
@@ -424,7 +489,7 @@ static void eval_performance(void *data)
  *  -- verify block address is within heap segment
  *  -- verify block address + size doesn't overlap any existing allocated block
  */
-static bool verify_block(void *ptr, size_t size, script_t *script, int lineno)
+static bool verify_block(void *ptr, size_t size, script_t *script, long lineno)
 {
     // address must be ALIGNMENT-byte aligned
     if (!IS_ALIGNED(ptr)) {
@@ -464,7 +529,7 @@ static bool verify_block(void *ptr, size_t size, script_t *script, int lineno)
  * Later when realloc'ing or freeing that block, check the payload to verify those
  * contents are still intact, otherwise raise allocator error.
  */
-static bool verify_payload(void *ptr, size_t size, int id, script_t *script, int lineno, char *op)
+static bool verify_payload(void *ptr, size_t size, int id, script_t *script, long lineno, char *op)
 {
     for (size_t i = 0; i < size; i++) {
         if (*((unsigned char *)ptr + i) != (id & 0xFF)) {
@@ -483,9 +548,15 @@ static void print_result(result_t *st, flags_t which, bool is_total)
 {
     printf("%-20s %-7s ", st->name, !is_total && (which & Correctness) ? (st->valid ? "Y" : "N") : "" );
     if (st->valid && (which & Performance))
-        printf("%7.0f%% %12d %14.6f %10d", st->utilization*100, st->num_ops, st->secs, st->tput);
+        printf("%7.0f%% %12ld %14.6f %10d", st->utilization*100, st->num_ops, st->secs, st->tput);
     else
         printf("%7s %12s %14s %10s","-","-","-","-");
+    if ((which & Misses) && st->valid && st->misses >= 0)
+        printf(" %12.2f", st->misses);
+    else if (which & Misses)
+        printf(" %12s", "n/a");
+    if (which & Stats)
+        printf(" %12.2f", st->valid ? st->relinks : 0);
     printf("\n");
 }
 
@@ -498,11 +569,12 @@ static void print_result(result_t *st, flags_t which, bool is_total)
 static void print_table(result_t result[], int n, flags_t which)
 {
     char *dashes = "-------------------------------------------------------------------------------";
-    result_t total = {.name = "Aggregate", .valid = true, .num_ops = 0, .secs = 0, .utilization = 0};
+    result_t total = {.name = "Aggregate", .valid = true, .num_ops = 0, .secs = 0, .utilization = 0, .misses = 0, .relinks = 0};
     int failures = 0;
 
     // Print the individual results for each script
-    printf("\n script name     correct?    utilization    requests       secs       Kreq/sec\n%s\n", dashes);
+    printf("\n script name     correct?    utilization    requests       secs       Kreq/sec%s%s\n%s\n",
+           (which & Misses) ? "   misses/req" : "", (which & Stats) ? "  relinks/req" : "", dashes);
     for (int i = 0; i < n; i++) {
         print_result(&result[i], which, false);
         if (!result[i].valid)
@@ -512,6 +584,11 @@ static void print_table(result_t result[], int n, flags_t which)
             total.num_ops += result[i].num_ops;
             total.utilization += result[i].utilization;
             total.tput += result[i].tput;
+            total.relinks += result[i].relinks;
+            if (result[i].misses < 0 || total.misses < 0)
+                total.misses = -1;
+            else
+                total.misses += result[i].misses;
         }
     }
     printf("%s\n\n", dashes);
@@ -521,6 +598,8 @@ static void print_table(result_t result[], int n, flags_t which)
     total.valid = (failures != n);  // if at least one script succeeded, total has some validity
     total.utilization /= n;
     total.tput /= n;
+    if (total.misses > 0) total.misses /= n - failures;
+    if (failures != n) total.relinks /= n - failures;
     print_result(&total, which, true);
     double rel_tput = (double)total.tput/TARGET_THRUPUT;
     if (which & Performance)
@@ -550,10 +629,10 @@ static void fatal_error(char *format, ...)
 }
 
 // Report errors from invoking student's allocator functions (non-fatal)
-static void allocator_error(script_t *script, int lineno, char* format, ...)
+static void allocator_error(script_t *script, long lineno, char* format, ...)
 {
     va_list args;
-    fprintf(stdout, "\nALLOCATOR ERROR [%s, line %d]: ", script->name, lineno);
+    fprintf(stdout, "\nALLOCATOR ERROR [%s, %s %ld]: ", script->name, script->ops ? "line" : "request", lineno);
     va_start(args, format);
     vfprintf(stdout, format, args);
     va_end(args);
@@ -566,6 +645,15 @@ static void usage()
    fprintf(stderr, "\t-c                Run only the correctness tests (no checks for performance).\n");
    fprintf(stderr, "\t-p                Run only the performance tests (no checks for correctness).\n");
    fprintf(stderr, "\t-f <file-or-dir>  Use <file> as script or read all script files from <dir>.\n");
+   fprintf(stderr, "\t                  Text .script files and binary .trace files from script2trace are taken.\n");
+   fprintf(stderr, "\t-m                Also count cache misses per request in the performance tests.\n");
+   fprintf(stderr, "\t-s                Also report free-list relinks per request in the performance tests.\n");
+   fprintf(stderr, "\t-l <snapshot>     Start each script on the heap saved in <snapshot> instead of an empty one.\n");
+   fprintf(stderr, "\t                  Utilization then only counts the blocks of the script, against what\n");
+   fprintf(stderr, "\t                  the heap grew by while it ran.\n");
+   fprintf(stderr, "\t-w <snapshot>     Save the heap left by each script to <snapshot>, the last script's is kept.\n");
+   fprintf(stderr, "\t-t                Stream each script from its file through one timed performance run,\n");
+   fprintf(stderr, "\t                  for scripts too large to load. No correctness checks or cache misses.\n");
    fprintf(stderr, "Without -f option, reads scripts from default path: %s\n", DEFAULT_SCRIPT_DIR);
    exit(107);
 }
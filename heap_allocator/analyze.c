@@ -0,0 +1,407 @@
+/*
+ * File: analyze.c
+ * ---------------
+ * Profiles what a script asks of an allocator, to pick bucket boundaries
+ * and size classes from the workloads themselves. It reports
+ *
+ *   - the sizes requested, by power of two
+ *   - the bytes live over the length of the script, and the peak
+ *   - the lifetimes of blocks in requests, from allocation to free
+ *   - the lengths of the realloc chains of blocks
+ *   - the size classes that waste the fewest bytes to rounding up
+ *
+ * The script, text or binary, is streamed in a single pass like
+ * alloctest -t does, so memory use depends only on the blocks live at once
+ * and traces of any length can be analyzed.
+ *
+ * Size classes are chosen for the requests of up to -m bytes, rounded up to
+ * the alignment and minimum payload of the allocator, with an exact dynamic
+ * program over the distinct rounded sizes: the best k classes covering the
+ * i smallest sizes are the best k - 1 covering some j of them plus one class
+ * for sizes j + 1 to i. The internal fragmentation it reports is the bytes
+ * of the class over the bytes requested, summed over every request, next to
+ * that of power-of-two classes.
+ *
+ * Usage: analyze [-k classes] [-m max] [-a alignment] <script|trace>
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "script.h"
+
+#define NUM_BINS 65     // bin 0 counts zeroes, bin k values from 2^(k-1) to 2^k - 1
+#define NUM_WINDOWS 32  // stretches of the script the live bytes are shown over
+#define FIRST_WINDOW 1024
+#define MIN_PAYLOAD 16  // smallest payload the allocator hands out
+#define BAR_WIDTH 40
+
+typedef struct {
+    uint64_t count;
+    uint64_t bytes;
+} bin_t;
+
+// a block live in the script
+typedef struct {
+    size_t size;
+    long born;          // request that allocated it, -1 if the slot is free
+    long reallocs;      // reallocs of it so far
+} life_t;
+
+// requests of each rounded size up to the largest with a size class
+typedef struct {
+    size_t align, max;
+    bin_t *sizes;       // sizes[i] counts the requests rounding up to i*align
+    uint64_t over;      // requests larger than max
+} rounding_t;
+
+static bin_t sizes[NUM_BINS], lifetimes[NUM_BINS], chains[NUM_BINS];
+static uint64_t num_allocs, num_reallocs, num_frees, unmatched, still_live;
+static size_t live_bytes, peak_bytes;
+static long live_blocks, peak_blocks, peak_at;
+static size_t window_peaks[NUM_WINDOWS];
+static long window_width = FIRST_WINDOW;
+static life_t *lives;
+static int nlives;
+static rounding_t rounding;
+
+static void analyze(stream_t *stream);
+static void report(const char *name, int nclasses);
+static void usage();
+static void fatal_error(char *format, ...);
+
+
+int main(int argc, char *argv[])
+{
+    int nclasses = 8;
+    rounding.align = 8;
+    rounding.max = 1024;
+    int c;
+
+    while ((c = getopt(argc, argv, "a:k:m:")) != EOF) {
+        switch (c) {
+            case 'a': rounding.align = strtoul(optarg, NULL, 10); break;
+            case 'k': nclasses = atoi(optarg); break;
+            case 'm': rounding.max = strtoul(optarg, NULL, 10); break;
+            default: usage();
+        }
+    }
+    if (optind != argc - 1 || nclasses < 1 || rounding.align == 0 ||
+        (rounding.align & (rounding.align - 1)) || rounding.max < rounding.align || rounding.max < MIN_PAYLOAD)
+        usage();
+    rounding.max -= rounding.max % rounding.align;
+    rounding.sizes = calloc(rounding.max/rounding.align + 1, sizeof(bin_t));
+    if (!rounding.sizes) fatal_error("Libc heap exhausted. Cannot continue.\n");
+
+    stream_t *stream = stream_open(argv[optind]);
+    if (!stream)
+        fatal_error("Could not stream script \"%s\".\n", argv[optind]);
+    analyze(stream);
+    if (!stream_close(stream))
+        fatal_error("Could not read \"%s\" through.\n", argv[optind]);
+
+    char name[128];
+    script_name(argv[optind], name, sizeof(name));
+    report(name, nclasses);
+    return 0;
+}
+
+
+/* Function: bin_of
+ * ----------------
+ * Returns the bin of a value in a histogram by power of two.
+ */
+static inline int bin_of(uint64_t value)
+{
+    return value ? 64 - __builtin_clzll(value) : 0;
+}
+
+static inline void add_to(bin_t *bins, uint64_t value, uint64_t bytes)
+{
+    bins[bin_of(value)].count++;
+    bins[bin_of(value)].bytes += bytes;
+}
+
+/* Function: count_size
+ * --------------------
+ * Counts the size of an alloc or realloc request.
+ */
+static void count_size(size_t size)
+{
+    add_to(sizes, size, size);
+    size_t rounded = size < MIN_PAYLOAD ? MIN_PAYLOAD : size;
+    if (rounded > rounding.max) {
+        rounding.over++;
+        return;
+    }
+    bin_t *bin = &rounding.sizes[(rounded + rounding.align - 1)/rounding.align];
+    bin->count++;
+    bin->bytes += size;
+}
+
+/* Function: end_life
+ * ------------------
+ * Counts the lifetime and realloc chain of a block that ends at now.
+ */
+static void end_life(life_t *life, long now)
+{
+    add_to(lifetimes, now - life->born, life->size);
+    add_to(chains, life->reallocs, life->size);
+    live_bytes -= life->size;
+    live_blocks--;
+    life->born = -1;
+}
+
+/* Function: analyze
+ * -----------------
+ * Takes in every request of the stream. The live bytes are shown over
+ * NUM_WINDOWS windows of requests, each with the peak reached in it; when
+ * the script outgrows them, neighbouring windows are merged and the windows
+ * made twice as wide.
+ */
+static void analyze(stream_t *stream)
+{
+    batch_t batch = {0};
+    long now = 0;
+    while (stream_next(stream, &batch)) {
+        if (batch.num_slots > nlives) {
+            int more = batch.num_slots > 2*nlives ? batch.num_slots : 2*nlives;
+            if (!(lives = realloc(lives, more*sizeof(life_t))))
+                fatal_error("Libc heap exhausted. Cannot continue.\n");
+            for (int i = nlives; i < more; i++) lives[i].born = -1;
+            nlives = more;
+        }
+        for (long i = 0; i < batch.num_ops; i++, now++) {
+            const request_t *req = &batch.ops[i];
+            life_t *life = &lives[req->id];
+
+            switch (req->op) {
+
+                case ALLOC:
+                    num_allocs++;
+                    if (life->born >= 0) end_life(life, now);
+                    *life = (life_t){.size = req->size, .born = now};
+                    live_bytes += req->size;
+                    live_blocks++;
+                    count_size(req->size);
+                    break;
+
+                case REALLOC:
+                    num_reallocs++;
+                    if (life->born >= 0) {
+                        live_bytes += req->size - life->size;
+                        life->size = req->size;
+                        life->reallocs++;
+                    } else {
+                        *life = (life_t){.size = req->size, .born = now};
+                        live_bytes += req->size;
+                        live_blocks++;
+                    }
+                    count_size(req->size);
+                    break;
+
+                case FREE:
+                    num_frees++;
+                    if (life->born >= 0) end_life(life, now);
+                    else unmatched++;
+                    break;
+            }
+
+            if (live_bytes > peak_bytes) {
+                peak_bytes = live_bytes;
+                peak_at = now + 1;
+            }
+            if (live_blocks > peak_blocks) peak_blocks = live_blocks;
+            if (now == NUM_WINDOWS*window_width) {
+                for (int w = 0; w < NUM_WINDOWS/2; w++)
+                    window_peaks[w] = window_peaks[2*w] > window_peaks[2*w+1] ? window_peaks[2*w] : window_peaks[2*w+1];
+                memset(window_peaks + NUM_WINDOWS/2, 0, sizeof(window_peaks)/2);
+                window_width *= 2;
+            }
+            size_t *peak = &window_peaks[now/window_width];
+            if (live_bytes > *peak) *peak = live_bytes;
+        }
+    }
+    for (int i = 0; i < nlives; i++) {
+        if (lives[i].born >= 0) {
+            still_live++;
+            add_to(chains, lives[i].reallocs, lives[i].size);
+        }
+    }
+}
+
+
+/* Function: bar
+ * -------------
+ * Returns a bar of up to BAR_WIDTH #s for part of whole.
+ */
+static const char *bar(uint64_t part, uint64_t whole)
+{
+    static char buf[BAR_WIDTH + 1];
+    int n = whole ? (int)((double)part/whole*BAR_WIDTH + 0.5) : 0;
+    memset(buf, '#', n);
+    buf[n] = '\0';
+    return buf;
+}
+
+static double percent(uint64_t part, uint64_t whole)
+{
+    return whole ? 100.0*part/whole : 0;
+}
+
+/* Function: print_bins
+ * --------------------
+ * Prints the bins of a histogram from the first to the last one used, with
+ * their counts, bytes and a bar of their share of the count.
+ */
+static void print_bins(const char *title, const char *unit, const bin_t *bins)
+{
+    uint64_t total = 0, most = 0;
+    int first = NUM_BINS, last = -1;
+    for (int i = 0; i < NUM_BINS; i++) {
+        total += bins[i].count;
+        if (bins[i].count > most) most = bins[i].count;
+        if (bins[i].count && first == NUM_BINS) first = i;
+        if (bins[i].count) last = i;
+    }
+    printf("\n%s\n%24s %12s %6s %14s\n", title, unit, "count", "%", "bytes");
+    for (int i = first; i <= last; i++) {
+        char range[48];
+        if (i <= 1) snprintf(range, sizeof(range), "%d", i);
+        else snprintf(range, sizeof(range), "%lu-%lu", 1UL << (i-1), (1UL << i) - 1);
+        printf("%24s %12lu %5.1f%% %14lu  %s\n", range, (unsigned long)bins[i].count,
+               percent(bins[i].count, total), (unsigned long)bins[i].bytes, bar(bins[i].count, most));
+    }
+}
+
+/* Function: class_waste
+ * ---------------------
+ * Returns the bytes wasted rounding requests of rounded sizes i to j up
+ * to j.
+ */
+static uint64_t class_waste(const bin_t *prefix, size_t align, int i, int j)
+{
+    return (prefix[j+1].count - prefix[i].count)*j*align - (prefix[j+1].bytes - prefix[i].bytes);
+}
+
+/* Function: print_classes
+ * -----------------------
+ * Chooses and prints the nclasses size classes that waste the fewest bytes
+ * on the requests counted in rounding, see the comment at the top. Takes
+ * O(nclasses * sizes^2) time over the distinct rounded sizes.
+ */
+static void print_classes(int nclasses)
+{
+    int nsizes = rounding.max/rounding.align + 1, m = 0;
+    uint64_t requested = 0, counted = 0, pow2_waste = 0;
+    int *rounded = malloc(nsizes*sizeof(int));
+    bin_t *prefix = calloc(nsizes + 1, sizeof(bin_t));
+    if (!rounded || !prefix) fatal_error("Libc heap exhausted. Cannot continue.\n");
+    for (int i = 0; i < nsizes; i++) {
+        const bin_t *bin = &rounding.sizes[i];
+        if (!bin->count) continue;
+        rounded[m++] = i;
+        requested += bin->bytes;
+        counted += bin->count;
+        size_t pow2 = (size_t)1 << bin_of(i*rounding.align - 1);
+        pow2_waste += bin->count*pow2 - bin->bytes;
+    }
+    for (int i = 0; i < nsizes; i++) {
+        prefix[i+1].count = prefix[i].count + rounding.sizes[i].count;
+        prefix[i+1].bytes = prefix[i].bytes + rounding.sizes[i].bytes;
+    }
+    printf("\nSize classes for the %lu requests up to %zu bytes (%lu larger)\n",
+           (unsigned long)counted, rounding.max, (unsigned long)rounding.over);
+    if (m == 0) goto done;
+    if (nclasses > m) nclasses = m;
+
+    // best[k*m + j] wastes the least covering rounded[0..j] with k + 1 classes, the
+    // largest being rounded[j]; from[k*m + j] is the index the largest class starts at
+    uint64_t *best = malloc((size_t)nclasses*m*sizeof(uint64_t));
+    int *from = malloc((size_t)nclasses*m*sizeof(int));
+    if (!best || !from) fatal_error("Libc heap exhausted. Cannot continue.\n");
+    for (int j = 0; j < m; j++) {
+        best[j] = class_waste(prefix, rounding.align, 0, rounded[j]);
+        from[j] = 0;
+    }
+    for (int k = 1; k < nclasses; k++) {
+        for (int j = 0; j < m; j++) {
+            best[k*m + j] = UINT64_MAX;
+            for (int i = k; i <= j; i++) {
+                uint64_t waste = best[(k-1)*m + i-1] + class_waste(prefix, rounding.align, rounded[i-1] + 1, rounded[j]);
+                if (waste < best[k*m + j]) {
+                    best[k*m + j] = waste;
+                    from[k*m + j] = i;
+                }
+            }
+        }
+    }
+
+    int *classes = malloc(nclasses*sizeof(int));
+    if (!classes) fatal_error("Libc heap exhausted. Cannot continue.\n");
+    for (int k = nclasses - 1, j = m - 1; k >= 0; j = from[k*m + j] - 1, k--)
+        classes[k] = rounded[j];
+    uint64_t waste = best[(nclasses-1)*m + m-1];
+    printf("%24s", "classes");
+    for (int k = 0; k < nclasses; k++) printf(" %zu", classes[k]*rounding.align);
+    printf("\n%24s %lu bytes, %.1f%% of %lu requested\n", "internal fragmentation",
+           (unsigned long)waste, percent(waste, requested), (unsigned long)requested);
+    printf("%24s %lu bytes, %.1f%%\n", "with powers of two", (unsigned long)pow2_waste, percent(pow2_waste, requested));
+    free(classes);
+    free(best);
+    free(from);
+done:
+    free(rounded);
+    free(prefix);
+}
+
+/* Function: report
+ * ----------------
+ * Prints everything gathered by analyze.
+ */
+static void report(const char *name, int nclasses)
+{
+    long num_ops = num_allocs + num_reallocs + num_frees;
+    printf("Profile of %s: %ld requests, %lu allocs, %lu reallocs, %lu frees",
+           name, num_ops, (unsigned long)num_allocs, (unsigned long)num_reallocs, (unsigned long)num_frees);
+    if (unmatched) printf(" (%lu of blocks never allocated)", (unsigned long)unmatched);
+    printf("\nPeak working set %zu bytes at request %ld, at most %ld blocks live, %lu live at the end\n",
+           peak_bytes, peak_at, peak_blocks, (unsigned long)still_live);
+
+    print_bins("Sizes requested by alloc and realloc", "bytes", sizes);
+
+    printf("\nBytes live over the script, peak in each %ld requests\n", window_width);
+    for (int w = 0; w < NUM_WINDOWS && w*window_width < num_ops; w++)
+        printf("%24ld %14zu  %s\n", w*window_width, window_peaks[w], bar(window_peaks[w], peak_bytes));
+
+    print_bins("Lifetimes of blocks freed, by bytes when freed", "requests", lifetimes);
+    print_bins("Reallocs of each block, by bytes at the end", "reallocs", chains);
+    print_classes(nclasses);
+}
+
+
+static void fatal_error(char *format, ...)
+{
+    fprintf(stderr, "\nFATAL ERROR: ");
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    exit(107);
+}
+
+static void usage()
+{
+   fprintf(stderr, "Usage: %s [-k classes] [-m max] [-a alignment] <script|trace>\n", program_invocation_short_name);
+   fprintf(stderr, "\t-k <classes>       Number of size classes to suggest (default 8).\n");
+   fprintf(stderr, "\t-m <max>           Largest size the classes cover, at least %d (default 1024).\n", MIN_PAYLOAD);
+   fprintf(stderr, "\t-a <alignment>     Power of two sizes are rounded up to (default 8).\n");
+   exit(107);
+}
@@ -0,0 +1,94 @@
+/*
+ * File: arena.c
+ * -------------
+ * Region allocation on top of the main heap. Each arena keeps a list of
+ * chunks from mymalloc, oldest first. Allocation bumps a pointer through
+ * the current chunk, and a reset just moves the pointer back to the start
+ * of the first chunk, so the chunks after it are refilled in order.
+ */
+
+#include <stdint.h>
+#include "arena.h"
+#include "allocator.h"
+
+#define DEFAULT_CHUNK_SIZE (64*1024)
+
+// Each chunk starts with this header, its space follows it
+struct arena_chunk {
+    arena_chunk *next;  // next newer chunk
+    size_t size;        // bytes of space after the header
+};
+
+/**
+ * Returns the first byte of space in chunk
+ */
+static inline char *chunk_space(arena_chunk *chunk)
+{
+    return (char *)chunk + sizeof(arena_chunk);
+}
+
+/**
+ * Makes chunk the one that allocations are bumped through
+ */
+static inline void enter_chunk(arena_t *arena, arena_chunk *chunk)
+{
+    arena->current = chunk;
+    arena->next = chunk_space(chunk);
+    arena->end = chunk_space(chunk) + chunk->size;
+}
+
+arena_t *arena_create(size_t chunk_size)
+{
+    if (chunk_size == 0) chunk_size = DEFAULT_CHUNK_SIZE;
+    arena_t *arena = mymalloc(sizeof(arena_t));
+    if (arena == NULL) return NULL;
+    // no chunk yet, the first allocation takes the slow path
+    arena->next = arena->end = NULL;
+    arena->first = arena->current = NULL;
+    arena->chunk_size = chunk_size;
+    return arena;
+}
+
+/**
+ * Function: arena_alloc_slow
+ * --------------------------
+ * The chunks after the current one are left over from before a reset and
+ * are reused if the request fits. Otherwise a new chunk is made, sized to
+ * the request if it is larger than a regular chunk, and linked in right
+ * after the current one so that the chunks already filled stay in front.
+ */
+void *arena_alloc_slow(arena_t *arena, size_t size)
+{
+    if (size > SIZE_MAX - sizeof(arena_chunk)) return NULL;
+    arena_chunk *after = arena->current == NULL ? arena->first : arena->current->next;
+    if (after == NULL || after->size < size) {
+        size_t chunk_size = size > arena->chunk_size ? size : arena->chunk_size;
+        arena_chunk *chunk = mymalloc(sizeof(arena_chunk) + chunk_size);
+        if (chunk == NULL) return NULL;
+        chunk->size = chunk_size;
+        chunk->next = after;
+        if (arena->current == NULL) arena->first = chunk;
+        else arena->current->next = chunk;
+        after = chunk;
+    }
+    enter_chunk(arena, after);
+    void *ptr = arena->next;
+    arena->next += size;
+    return ptr;
+}
+
+void arena_reset(arena_t *arena)
+{
+    if (arena->first != NULL) enter_chunk(arena, arena->first);
+}
+
+void arena_release(arena_t *arena)
+{
+    arena_chunk *chunk = arena->first;
+    while (chunk != NULL) {
+        arena_chunk *next = chunk->next;
+        myfree(chunk);
+        chunk = next;
+    }
+    myfree(arena);
+}
@@ -0,0 +1,94 @@
+/* File: arena.h
+ * -------------
+ * Interface file for region allocation. An arena hands out memory by
+ * bumping a pointer through chunks taken from the main heap. Objects
+ * have no headers and are never freed one at a time, the whole arena
+ * is given back at once with arena_reset or arena_release.
+ */
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for SIZE_MAX
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Blocks from an arena are aligned the same as blocks from mymalloc
+#define ARENA_ALIGNMENT 8
+
+typedef struct arena_chunk arena_chunk;
+
+/* Type: arena_t
+ * -------------
+ * The bump pointer and the end of the chunk it is moving through are kept
+ * in the arena itself, so that the fast path of arena_alloc only touches
+ * the arena. The fields are private to arena.c and the inline functions.
+ */
+typedef struct {
+    char *next;            // first free byte of the current chunk
+    char *end;             // end of the current chunk
+    arena_chunk *first;    // oldest chunk, where a reset arena starts over
+    arena_chunk *current;  // chunk that next points into
+    size_t chunk_size;     // bytes of usable space in a regular chunk
+} arena_t;
+
+
+/* Function: arena_create
+ * ----------------------
+ * Makes a new empty arena that takes chunk_size bytes at a time from the
+ * main heap (or a default size if chunk_size is 0). Returns NULL if the
+ * main heap is out of memory.
+ */
+arena_t *arena_create(size_t chunk_size);
+
+
+/* Function: arena_alloc_slow
+ * --------------------------
+ * Called by arena_alloc when the current chunk is full. Moves on to the
+ * next chunk, taking a new one from the main heap if there is none that
+ * is big enough.
+ */
+void *arena_alloc_slow(arena_t *arena, size_t size);
+
+
+/* Function: arena_alloc
+ * ---------------------
+ * Returns size bytes from the arena, or NULL if the main heap is out of
+ * memory or size is too large to round up to the alignment. The memory
+ * stays valid until the arena is reset or released.
+ */
+static inline void *arena_alloc(arena_t *arena, size_t size)
+{
+    if (size > SIZE_MAX - (ARENA_ALIGNMENT-1)) return NULL;
+    size = (size + ARENA_ALIGNMENT-1) & ~(size_t)(ARENA_ALIGNMENT-1);
+    if (size <= (size_t)(arena->end - arena->next)) {
+        void *ptr = arena->next;
+        arena->next += size;
+        return ptr;
+    }
+    return arena_alloc_slow(arena, size);
+}
+
+
+/* Function: arena_reset
+ * ---------------------
+ * Frees everything allocated from the arena in one step. The chunks are
+ * kept and reused by later allocations.
+ */
+void arena_reset(arena_t *arena);
+
+
+/* Function: arena_release
+ * -----------------------
+ * Frees everything allocated from the arena and gives its chunks and the
+ * arena itself back to the main heap.
+ */
+void arena_release(arena_t *arena);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
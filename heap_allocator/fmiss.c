@@ -0,0 +1,53 @@
+/*
+ * File: fmiss.c
+ * -------------
+ * Counts the hardware cache misses of a test function using the Linux
+ * perf_event_open interface. Counting is limited to user space, so only
+ * the misses of the function itself (not of the kernel servicing its
+ * page faults) are reported. Many virtual machines and locked-down
+ * kernels do not expose the counters, in which case -1 is returned.
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "fmiss.h"
+
+/*
+ * open_counter - Open a counter of cache misses for this thread,
+ *     returns the file descriptor or -1 on failure
+ */
+static int open_counter()
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/*
+ * fmisses - Return the cache misses of one run of f
+ */
+long long fmisses(test_funct f, void *argp)
+{
+    long long count;
+    int fd = open_counter();
+    if (fd == -1)
+        return -1;
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    f(argp);
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(fd, &count, sizeof(count)) != sizeof(count))
+        count = -1;
+    close(fd);
+    return count;
+}
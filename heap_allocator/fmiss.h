@@ -0,0 +1,14 @@
+/*
+ * fmiss.h - prototype for the routine in fmiss.c that counts the
+ *     cache misses incurred by a test function f
+ */
+#ifndef _FMISS_H
+#define _FMISS_H
+
+#include "fcyc.h"
+
+/* Count last-level cache misses of one run of test function f,
+   returns -1 if the hardware counters are not available */
+long long fmisses(test_funct f, void *argp);
+
+#endif
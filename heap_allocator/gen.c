@@ -0,0 +1,386 @@
+/*
+ * File: gen.c
+ * -----------
+ * Generates allocator scripts from statistical models of a workload, for
+ * benchmarking on shapes and at scales the sample scripts do not cover.
+ * A workload is a sequence of phases, each of a number of requests drawn
+ * from its own models:
+ *
+ *   size   distribution of the sizes allocated, in bytes
+ *   life   distribution of block lifetimes, in requests
+ *   grow   fraction of blocks that grow by realloc, the factor they grow
+ *          by each time, and how many times, spread over their lifetime
+ *   end    whether the blocks still live are freed when the phase ends
+ *
+ * Distributions are written as
+ *
+ *   fixed:N                 always N
+ *   uniform:MIN:MAX         evenly between MIN and MAX
+ *   power:MIN:MAX:ALPHA     power law (Pareto) of exponent ALPHA, cut at MAX
+ *   bimodal:A:B:P           A with probability P, else B
+ *   exp:MEAN                exponential of mean MEAN
+ *   never                   lifetime only, blocks live to the end
+ *
+ * and a phase as comma-separated settings, each phase starting from the
+ * settings of the one before, e.g.
+ *
+ *   gen -p n=50000,size=power:16:4096:1.5,life=exp:500
+ *       -p n=50000,size=bimodal:32:1024:0.9,grow=0.1:2:6,end=free  out.trace
+ *
+ * Time is counted in requests: a block with lifetime L is freed L requests
+ * after it is allocated, or as soon after as the frees due before it allow.
+ * Ids are recycled once freed. The output is written as it is generated, a
+ * binary trace or a text script if its name ends in .script, so any length
+ * can be generated in constant memory beyond the blocks live at once. The
+ * same seed and phases always give the same script.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "script.h"
+
+#define MAX_PHASES 32
+
+typedef struct {
+    enum { FIXED, UNIFORM, POWER, BIMODAL, EXPONENTIAL, NEVER } kind;
+    double a, b, c;     // parameters, in the order they are written
+} dist_t;
+
+typedef struct {
+    long n;             // requests in the phase, not counting the frees at its end
+    dist_t size;
+    dist_t life;
+    double grow;        // fraction of blocks that grow
+    double factor;      // how much a growing block grows each time
+    int steps;          // how many times a growing block grows
+    bool free_at_end;
+} phase_t;
+
+// a block due to grow or be freed at time
+typedef struct {
+    long time;
+    int id;
+} due_t;
+
+// the blocks live, by id
+typedef struct {
+    size_t size;        // 0 if the id is free
+    int steps;          // growths still to come
+    long gap;           // requests between growths
+} block_info_t;
+
+static uint64_t rng_state;
+static trace_writer_t out;
+static block_info_t *blocks;
+static int num_ids, *free_ids, nfree;
+static long ids_capacity, free_capacity;
+static due_t *dues;
+static long ndues, dues_capacity;
+static size_t live_bytes, peak_bytes;
+
+static bool parse_phase(char *spec, phase_t *phase);
+static void run_phase(const phase_t *phase, long *clock);
+static void usage();
+static void fatal_error(char *format, ...);
+
+
+int main(int argc, char *argv[])
+{
+    phase_t phases[MAX_PHASES];
+    phase_t current = {
+        .n = 100000,
+        .size = {POWER, 16, 4096, 1.5},
+        .life = {EXPONENTIAL, 1000},
+        .factor = 2,
+        .steps = 4,
+    };
+    int nphases = 0;
+    uint64_t seed = 107;
+    int c;
+
+    while ((c = getopt(argc, argv, "p:s:")) != EOF) {
+        switch (c) {
+            case 'p':
+                if (nphases == MAX_PHASES || !parse_phase(optarg, &current)) usage();
+                phases[nphases++] = current;
+                break;
+            case 's': seed = strtoull(optarg, NULL, 10); break;
+            default: usage();
+        }
+    }
+    if (optind != argc - 1) usage();
+    if (nphases == 0) phases[nphases++] = current;
+
+    rng_state = seed;
+    if (!trace_open(&out, argv[optind]))
+        fatal_error("Could not create \"%s\".\n", argv[optind]);
+    long clock = 0;
+    for (int i = 0; i < nphases; i++)
+        run_phase(&phases[i], &clock);
+    if (!trace_close(&out))
+        fatal_error("Could not write \"%s\".\n", argv[optind]);
+    printf("%s: %lu requests, %lu ids, peak %zu bytes live\n", argv[optind],
+           (unsigned long)out.num_ops, (unsigned long)out.num_ids, peak_bytes);
+    return 0;
+}
+
+
+/* Function: random_unit
+ * ---------------------
+ * Returns a uniform random number in [0, 1), from splitmix64 so that the
+ * scripts do not depend on the C library's generator.
+ */
+static double random_unit(void)
+{
+    uint64_t z = (rng_state += 0x9e3779b97f4a7c15UL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9UL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebUL;
+    z ^= z >> 31;
+    return (z >> 11) * 0x1.0p-53;
+}
+
+/* Function: draw
+ * --------------
+ * Draws a value from a distribution, -1 for never.
+ */
+static double draw(const dist_t *d)
+{
+    double u = random_unit();
+    switch (d->kind) {
+        case FIXED:       return d->a;
+        case UNIFORM:     return floor(d->a + u*(d->b - d->a + 1));
+        case POWER:       return floor(d->a * pow(1 - u*(1 - pow(d->a/d->b, d->c)), -1/d->c));
+        case BIMODAL:     return u < d->c ? d->a : d->b;
+        case EXPONENTIAL: return floor(-d->a * log(1 - u));
+        case NEVER:       return -1;
+    }
+    return 0;
+}
+
+
+/* Function: parse_dist
+ * --------------------
+ * Parses a distribution as written in the comment at the top. Returns
+ * false if it is malformed.
+ */
+static bool parse_dist(const char *text, dist_t *d)
+{
+    char name[16];
+    int used = 0;
+    d->a = d->b = d->c = 0;
+    if (sscanf(text, "%15[a-z]%n", name, &used) != 1) return false;
+    const char *params = text + used;
+    if (strcmp(name, "fixed") == 0) {
+        d->kind = FIXED;
+        return sscanf(params, ":%lf%n", &d->a, &used) == 1 && params[used] == '\0' && d->a >= 0;
+    } else if (strcmp(name, "uniform") == 0) {
+        d->kind = UNIFORM;
+        return sscanf(params, ":%lf:%lf%n", &d->a, &d->b, &used) == 2 && params[used] == '\0' &&
+               d->a >= 0 && d->b >= d->a;
+    } else if (strcmp(name, "power") == 0) {
+        d->kind = POWER;
+        return sscanf(params, ":%lf:%lf:%lf%n", &d->a, &d->b, &d->c, &used) == 3 && params[used] == '\0' &&
+               d->a >= 1 && d->b >= d->a && d->c > 0;
+    } else if (strcmp(name, "bimodal") == 0) {
+        d->kind = BIMODAL;
+        return sscanf(params, ":%lf:%lf:%lf%n", &d->a, &d->b, &d->c, &used) == 3 && params[used] == '\0' &&
+               d->a >= 0 && d->b >= 0 && d->c >= 0 && d->c <= 1;
+    } else if (strcmp(name, "exp") == 0) {
+        d->kind = EXPONENTIAL;
+        return sscanf(params, ":%lf%n", &d->a, &used) == 1 && params[used] == '\0' && d->a > 0;
+    } else if (strcmp(name, "never") == 0) {
+        d->kind = NEVER;
+        return *params == '\0';
+    }
+    return false;
+}
+
+/* Function: parse_phase
+ * ---------------------
+ * Parses the settings of a phase into phase, which holds those of the
+ * phase before. Returns false if any setting is malformed.
+ */
+static bool parse_phase(char *spec, phase_t *phase)
+{
+    char *save;
+    for (char *setting = strtok_r(spec, ",", &save); setting; setting = strtok_r(NULL, ",", &save)) {
+        char *value = strchr(setting, '=');
+        if (!value) return false;
+        *value++ = '\0';
+        int used = 0;
+        if (strcmp(setting, "n") == 0) {
+            if (sscanf(value, "%ld%n", &phase->n, &used) != 1 || value[used] || phase->n < 0) return false;
+        } else if (strcmp(setting, "size") == 0) {
+            if (!parse_dist(value, &phase->size) || phase->size.kind == NEVER) return false;
+        } else if (strcmp(setting, "life") == 0) {
+            if (!parse_dist(value, &phase->life)) return false;
+        } else if (strcmp(setting, "grow") == 0) {
+            if (sscanf(value, "%lf:%lf:%d%n", &phase->grow, &phase->factor, &phase->steps, &used) != 3 ||
+                value[used] || phase->grow < 0 || phase->grow > 1 || phase->factor <= 0 || phase->steps < 0)
+                return false;
+        } else if (strcmp(setting, "end") == 0) {
+            if (strcmp(value, "free") != 0 && strcmp(value, "keep") != 0) return false;
+            phase->free_at_end = strcmp(value, "free") == 0;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/* Function: emit
+ * --------------
+ * Writes one request of the script.
+ */
+static void emit(int op, int id, size_t size)
+{
+    request_t req = {.op = op, .id = id, .size = size};
+    if (!trace_put(&out, &req))
+        fatal_error("Could not write the script.\n");
+}
+
+/* Function: grow_array
+ * --------------------
+ * Makes room for n + 1 elements of size in *array, doubling it.
+ */
+static void grow_array(void *array, long n, long *capacity, size_t size)
+{
+    if (n < *capacity) return;
+    *capacity = *capacity ? 2 * *capacity : 1024;
+    void *more = realloc(*(void **)array, *capacity * size);
+    if (!more) fatal_error("Out of memory for the blocks live.\n");
+    *(void **)array = more;
+}
+
+/* Function: push_due
+ * ------------------
+ * Adds a block to the heap of blocks due, ordered by time and then by id
+ * so that the order never depends on the heap's layout.
+ */
+static bool due_before(const due_t *a, const due_t *b)
+{
+    return a->time < b->time || (a->time == b->time && a->id < b->id);
+}
+
+static void push_due(long time, int id)
+{
+    grow_array(&dues, ndues, &dues_capacity, sizeof(due_t));
+    due_t due = {time, id};
+    long i = ndues++;
+    for (; i > 0 && due_before(&due, &dues[(i-1)/2]); i = (i-1)/2)
+        dues[i] = dues[(i-1)/2];
+    dues[i] = due;
+}
+
+static due_t pop_due(void)
+{
+    due_t top = dues[0], last = dues[--ndues];
+    long i = 0;
+    for (long child; (child = 2*i + 1) < ndues; i = child) {
+        if (child + 1 < ndues && due_before(&dues[child+1], &dues[child])) child++;
+        if (!due_before(&dues[child], &last)) break;
+        dues[i] = dues[child];
+    }
+    if (ndues > 0) dues[i] = last;
+    return top;
+}
+
+/* Function: clamp_size
+ * --------------------
+ * Returns a drawn size as a request size, at least 1 and at most
+ * INT_MAX.
+ */
+static size_t clamp_size(double size)
+{
+    return size < 1 ? 1 : size > INT_MAX ? INT_MAX : (size_t)size;
+}
+
+static void free_block(int id)
+{
+    emit(FREE, id, 0);
+    live_bytes -= blocks[id].size;
+    blocks[id].size = 0;
+    grow_array(&free_ids, nfree, &free_capacity, sizeof(int));
+    free_ids[nfree++] = id;
+}
+
+/* Function: run_phase
+ * -------------------
+ * Generates the requests of one phase. Each request frees or grows the
+ * block due first if it is due by now, else allocates a new block.
+ */
+static void run_phase(const phase_t *phase, long *clock)
+{
+    for (long end = *clock + phase->n; *clock < end; (*clock)++) {
+        if (ndues > 0 && dues[0].time <= *clock) {
+            due_t due = pop_due();
+            block_info_t *block = &blocks[due.id];
+            if (block->steps == 0) {
+                free_block(due.id);
+                continue;
+            }
+            size_t size = clamp_size(block->size * phase->factor);
+            emit(REALLOC, due.id, size);
+            live_bytes += size - block->size;
+            block->size = size;
+            block->steps--;
+            push_due(*clock + block->gap, due.id);
+        } else {
+            int id = nfree > 0 ? free_ids[--nfree] : num_ids;
+            if (id == num_ids) grow_array(&blocks, num_ids++, &ids_capacity, sizeof(block_info_t));
+            block_info_t *block = &blocks[id];
+            block->size = clamp_size(draw(&phase->size));
+            double life = draw(&phase->life);
+            bool grows = phase->steps > 0 && random_unit() < phase->grow;
+            block->steps = grows ? phase->steps : 0;
+            block->gap = life < 0 ? 0 : 1 + (long)life/(block->steps + 1);
+            emit(ALLOC, id, block->size);
+            live_bytes += block->size;
+            if (life >= 0) push_due(*clock + block->gap, id);
+        }
+        if (live_bytes > peak_bytes) peak_bytes = live_bytes;
+    }
+
+    if (phase->free_at_end) {
+        ndues = 0;
+        for (int id = 0; id < num_ids; id++)
+            if (blocks[id].size) free_block(id);
+    }
+}
+
+
+static void fatal_error(char *format, ...)
+{
+    fprintf(stderr, "\nFATAL ERROR: ");
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    exit(107);
+}
+
+static void usage()
+{
+   fprintf(stderr, "Usage: %s [-s seed] [-p phase]... <out.trace|out.script>\n", program_invocation_short_name);
+   fprintf(stderr, "\t-s <seed>          Seed of the random choices (default 107).\n");
+   fprintf(stderr, "\t-p <phase>         Add a phase, settings separated by commas, each kept from the phase before:\n");
+   fprintf(stderr, "\t   n=<requests>    Requests in the phase (default 100000).\n");
+   fprintf(stderr, "\t   size=<dist>     Sizes allocated (default power:16:4096:1.5).\n");
+   fprintf(stderr, "\t   life=<dist>     Lifetimes of blocks in requests (default exp:1000).\n");
+   fprintf(stderr, "\t   grow=<p>:<f>:<k> Fraction p of blocks grow by factor f, k times over their life (default 0:2:4).\n");
+   fprintf(stderr, "\t   end=free|keep   Free the blocks still live at the end of the phase (default keep).\n");
+   fprintf(stderr, "\tDistributions: fixed:N uniform:MIN:MAX power:MIN:MAX:ALPHA bimodal:A:B:P exp:MEAN never\n");
+   fprintf(stderr, "A name ending in .script gives a text script, any other a binary trace.\n");
+   exit(107);
+}
@@ -0,0 +1,634 @@
+/*
+ * File: heaptest.c
+ * ----------------
+ * Tests of the heap interface beyond what the scripts of alloctest reach:
+ * heaps of their own, alignment, hints and deferred work, each exercised
+ * by a random mix of calls checked with myheap_validate. It is built
+ * against every variant of the allocator, see make test.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "allocator.h"
+#include "segment.h"
+
+// blocks live at once in a random mix
+#define NSLOTS 1000
+
+static int failures = 0;
+
+/* Function: check
+ * ---------------
+ * Counts and reports a failed check, returning ok.
+ */
+static bool check(bool ok, const char *what)
+{
+    if (!ok) {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+    return ok;
+}
+
+/* Function: next_random
+ * ---------------------
+ * Returns the next number of a xorshift generator, so that every run
+ * makes the same calls.
+ */
+static uint64_t next_random(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+/* Function: random_size
+ * ---------------------
+ * Returns a request size, mostly small with now and then a large one,
+ * never 0 which the heap refuses.
+ */
+static size_t random_size(uint64_t *state)
+{
+    uint64_t r = next_random(state);
+    switch (r % 16) {
+        case 0: return 1 + (r >> 40 & 0xfffff);   // up to 1 MB
+        case 1: case 2: return 1 + (r >> 40 & 0xffff);
+        default: return 1 + (r >> 40 & 0x1ff);
+    }
+}
+
+typedef struct {
+    unsigned char *ptr;
+    size_t size;
+    unsigned char fill;
+} slot_t;
+
+static void fill_slot(slot_t *slot, unsigned char fill)
+{
+    slot->fill = fill;
+    memset(slot->ptr, fill, slot->size);
+}
+
+/* Function: intact
+ * ----------------
+ * Returns whether the first n bytes of the block of slot still hold its fill.
+ */
+static bool intact(const slot_t *slot, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        if (slot->ptr[i] != slot->fill) return false;
+    return true;
+}
+
+/* Function: random_mix
+ * --------------------
+ * Runs nops random calls on heap, allocating with and without alignment
+ * and hints, reallocating, resizing, freeing and doing deferred work, and
+ * checks the contents of the blocks and the heap as it goes. Frees every
+ * block at the end.
+ */
+static void random_mix(myheap_t *heap, uint64_t seed, int nops)
+{
+    static slot_t slots[NSLOTS];
+    uint64_t state = seed;
+    memset(slots, 0, sizeof(slots));
+    for (int op = 0; op < nops; op++) {
+        uint64_t r = next_random(&state);
+        slot_t *slot = &slots[r % NSLOTS];
+        unsigned char fill = r >> 32;
+        size_t size = random_size(&state);
+        if (slot->ptr != NULL) {
+            if (!check(intact(slot, slot->size), "block contents kept")) return;
+            switch (r >> 16 & 7) {
+                case 0: case 1: case 2:
+                    // the default heap is also freed by size, as sized operator delete does
+                    if (heap == myheap_default() && (r >> 19 & 1))
+                        myfree_sized(slot->ptr, slot->size);
+                    else
+                        myheap_free(heap, slot->ptr);
+                    slot->ptr = NULL;
+                    break;
+                case 3: case 4: {
+                    unsigned char *ptr = myheap_realloc(heap, slot->ptr, size);
+                    if (!check(ptr != NULL, "realloc")) return;
+                    size_t kept = size < slot->size ? size : slot->size;
+                    slot->ptr = ptr;
+                    if (!check(intact(slot, kept), "contents moved by realloc")) return;
+                    slot->size = size;
+                    fill_slot(slot, fill);
+                    break;
+                }
+                case 5:
+                    if (myheap_resize(heap, slot->ptr, size)) {
+                        size_t kept = size < slot->size ? size : slot->size;
+                        slot->size = size;
+                        if (!check(intact(slot, kept), "contents kept by resize")) return;
+                        fill_slot(slot, fill);
+                    }
+                    break;
+                default:
+                    myheap_maintain(heap, 1000);
+                    break;
+            }
+            continue;
+        }
+        switch (r >> 16 & 7) {
+            case 0: {
+                size_t alignment = (size_t)16 << (r >> 20 & 7);
+                slot->ptr = myheap_memalign(heap, alignment, size);
+                if (slot->ptr != NULL && !check((uintptr_t)slot->ptr % alignment == 0, "memalign alignment"))
+                    return;
+                break;
+            }
+            case 1: {
+                slot_t *near = &slots[(r >> 24) % NSLOTS];
+                alloc_hint_t hint = (r >> 20 & 1) ? ALLOC_LONG_LIVED : ALLOC_SHORT_LIVED;
+                slot->ptr = myheap_malloc_hint(heap, size, hint, near->ptr);
+                break;
+            }
+            default:
+                slot->ptr = myheap_malloc(heap, size);
+                break;
+        }
+        if (!check(slot->ptr != NULL, "allocation")) return;
+        if (!check((uintptr_t)slot->ptr % 8 == 0, "payload alignment")) return;
+        slot->size = size;
+        fill_slot(slot, fill);
+        if (op % 512 == 0 && !check(myheap_validate(heap), "heap valid during random mix")) return;
+    }
+    for (int i = 0; i < NSLOTS; i++) {
+        if (slots[i].ptr == NULL) continue;
+        check(intact(&slots[i], slots[i].size), "block contents kept to the end");
+        myheap_free(heap, slots[i].ptr);
+        slots[i].ptr = NULL;
+    }
+    check(myheap_validate(heap), "heap valid after random mix");
+}
+
+/* Function: test_heaps
+ * --------------------
+ * Makes several heaps, runs a mix on each with some of them alive at once,
+ * and destroys them out of order with blocks still allocated.
+ */
+static void test_heaps(void)
+{
+    myheap_t *heaps[4];
+    for (int i = 0; i < 4; i++) {
+        heaps[i] = myheap_create();
+        if (!check(heaps[i] != NULL, "myheap_create")) return;
+        check(myheap_validate(heaps[i]), "new heap valid");
+    }
+    for (int i = 0; i < 4; i++) {
+        random_mix(heaps[i], 0x9e3779b97f4a7c15ULL * (i + 1), 20000);
+        for (int j = 0; j < 100; j++) myheap_malloc(heaps[i], 100 + j);
+    }
+    myheap_destroy(heaps[2]);
+    myheap_destroy(heaps[0]);
+    myheap_t *again = myheap_create();
+    check(again != NULL && myheap_validate(again), "heap made after others are destroyed");
+    myheap_destroy(again);
+    myheap_destroy(heaps[3]);
+    myheap_destroy(heaps[1]);
+}
+
+/* Function: test_default_heap
+ * ---------------------------
+ * Runs a mix on the default heap, starting over with myinit.
+ */
+static void test_default_heap(void)
+{
+    if (!check(myinit(), "myinit")) return;
+    random_mix(myheap_default(), 12345, 40000);
+    check(myinit() && validate_heap(), "default heap valid after myinit");
+}
+
+/* Function: fill_region
+ * ----------------------
+ * Fills heap, which is over the len bytes at base, with blocks of size
+ * bytes, each set to a byte of its own, up to max of them. Checks that
+ * they all lie in the region and that the heap stops there. Returns the
+ * number of blocks put in blocks.
+ */
+static int fill_region(myheap_t *heap, char *base, size_t len, void **blocks, int max, size_t size)
+{
+    int n = 0;
+    while (n < max && (blocks[n] = myheap_malloc(heap, size)) != NULL) {
+        char *p = blocks[n];
+        if (!check(p >= base && p + size <= base + len, "block inside the region")) break;
+        if (!check((uintptr_t)p % 8 == 0, "payload alignment in a region")) break;
+        memset(p, n & 0xff, size);
+        n++;
+    }
+    check(n < max, "region fills up");
+    for (int i = 0; i < n; i++) {
+        unsigned char *p = blocks[i];
+        if (!check(p[0] == (i & 0xff) && p[size-1] == (i & 0xff), "blocks of a region apart")) break;
+    }
+    return n;
+}
+
+/* Function: test_regions
+ * ----------------------
+ * Makes heaps over regions of the caller's: refuses regions too small to
+ * hold one, lays heaps over bases off any alignment, fills them to the end
+ * of the region without writing past it, and reuses what is freed, up to
+ * most of the region in one block once the small ones are all freed.
+ */
+static void test_regions(void)
+{
+    enum { LEN = 1 << 20, GUARD = 64, MAXBLOCKS = 8000 };
+    static char region[LEN + 16 + GUARD];
+    static void *blocks[MAXBLOCKS];
+    check(myheap_init_in(NULL, LEN) == NULL, "no heap over NULL");
+
+    // the smallest region that holds a heap, anything under it is refused
+    size_t smallest = 0;
+    for (size_t len = 0; len <= 4096 && smallest == 0; len++) {
+        myheap_t *heap = myheap_init_in(region + 1, len);
+        if (heap == NULL) continue;
+        smallest = len;
+        check((char *)heap >= region + 1, "heap state inside its region");
+        void *block = myheap_malloc(heap, 1);
+        check(block != NULL && (char *)block < region + 1 + len, "smallest heap holds a block");
+        myheap_free(heap, block);
+        check(myheap_validate(heap), "smallest heap valid");
+        myheap_destroy(heap);
+    }
+    check(smallest > 0, "a small region holds a heap");
+    for (size_t len = smallest; len < smallest + 64; len++) {
+        myheap_t *heap = myheap_init_in(region + 1, len);
+        check(heap != NULL, "region larger than the smallest holds a heap");
+        myheap_destroy(heap);
+    }
+
+    for (size_t offset = 0; offset < 16; offset += 3) {
+        char *base = region + offset;
+        memset(base + LEN, 0xa5, GUARD);
+        myheap_t *heap = myheap_init_in(base, LEN);
+        if (!check(heap != NULL, "myheap_init_in")) return;
+        int n = fill_region(heap, base, LEN, blocks, MAXBLOCKS, 200);
+        check(n > 4000, "region filled with small blocks");
+        check(myheap_malloc(heap, 200) == NULL, "full region refuses more");
+        // every other block freed is had again, in the region
+        int freed = 0, again = 0;
+        for (int i = 0; i < n; i += 2, freed++) myheap_free(heap, blocks[i]);
+        for (int i = 0; i < n; i += 2) {
+            blocks[i] = myheap_malloc(heap, 200);
+            if (blocks[i] == NULL) break;
+            check((char *)blocks[i] >= base && (char *)blocks[i] < base + LEN, "reused block inside the region");
+            again++;
+        }
+        check(again == freed, "freed space of a region reused");
+        check(myheap_validate(heap), "region heap valid after reuse");
+        for (int i = 0; i < n; i++) myheap_free(heap, blocks[i]);
+        // the space has to come from the small blocks, wherever they are held
+        void *big = myheap_malloc(heap, 900000);
+        check(big != NULL, "large block from the space of the small ones");
+        check((char *)big >= base && (char *)big + 900000 <= base + LEN, "large block in the region");
+        check(myheap_validate(heap), "region heap valid after freeing it all");
+        bool kept = true;
+        for (int i = 0; i < GUARD; i++) kept = kept && (unsigned char)base[LEN + i] == 0xa5;
+        check(kept, "nothing written past the region");
+        myheap_destroy(heap);
+    }
+}
+
+/* Function: test_compaction
+ * --------------------------
+ * Compacts the default heap holding handle blocks, some of them locked,
+ * among ordinary blocks with the freed ones in between. Only the lower
+ * half of the heap has blocks that cannot move. Every block has
+ * to keep its contents, the locked and ordinary ones their address too,
+ * and the space gathered at the top has to go back to the segment.
+ */
+static void test_compaction(void)
+{
+    enum { NHANDLES = 400 };
+    static myhandle_t handles[NHANDLES];
+    static unsigned char *pinned[NHANDLES], *locked_at[NHANDLES];
+    if (!check(myinit(), "myinit")) return;
+    for (int i = 0; i < NHANDLES; i++) {
+        size_t size = 100 + (i * 397) % 4000;
+        handles[i] = myhandle_alloc(size);
+        if (!check(handles[i] != NULL, "myhandle_alloc")) return;
+        memset(myhandle_lock(handles[i]), i & 0xff, 100);
+        myhandle_unlock(handles[i]);
+        // only among the lower half, which leaves the upper half free to gather at the top
+        pinned[i] = (i % 8 == 0 && i < NHANDLES/2) ? mymalloc(64) : NULL;
+        if (pinned[i] != NULL) memset(pinned[i], ~i & 0xff, 64);
+    }
+    for (int i = 1; i < NHANDLES; i += 2) {
+        myhandle_free(handles[i]);
+        handles[i] = NULL;
+    }
+    for (int i = 0; i < NHANDLES/2; i += 34) locked_at[i] = myhandle_lock(handles[i]);
+    size_t before = heap_segment_size();
+    check(mycompact() > 0, "compaction moves blocks");
+    check(validate_heap(), "heap valid after compaction");
+    // about half of the upper half was freed, a good part of it is given back
+    check(heap_segment_size() + 32*PAGE_SIZE <= before, "compaction gives pages back");
+    for (int i = 0; i < NHANDLES; i++) {
+        if (pinned[i] != NULL) {
+            bool kept = true;
+            for (int j = 0; j < 64; j++) kept = kept && pinned[i][j] == (~i & 0xff);
+            check(kept, "ordinary block kept by compaction");
+        }
+        if (handles[i] == NULL) continue;
+        unsigned char *data = myhandle_lock(handles[i]);
+        bool kept = true;
+        for (int j = 0; j < 100; j++) kept = kept && data[j] == (i & 0xff);
+        check(kept, "handle contents kept by compaction");
+        if (locked_at[i] != NULL) {
+            check(data == locked_at[i], "locked handle not moved");
+            myhandle_unlock(handles[i]);
+        }
+        myhandle_unlock(handles[i]);
+    }
+    mycompact();
+    check(validate_heap(), "heap valid after compacting it unlocked");
+    for (int i = 0; i < NHANDLES; i++) {
+        if (handles[i] != NULL) myhandle_free(handles[i]);
+        myfree(pinned[i]);
+    }
+    check(validate_heap(), "heap valid with the handles freed");
+}
+
+/* Function: fill_to_overflow
+ * ---------------------------
+ * Allocates large blocks from heap until one has to come from a heap
+ * chained after it, the segment of heap being full. Returns the number of
+ * blocks put in blocks, the last of them the one outside the segment, or
+ * 0 if no block got there.
+ */
+static int fill_to_overflow(myheap_t *heap, void **blocks, int max)
+{
+    char *first = NULL;
+    for (int n = 0; n < max; ) {
+        void *block = myheap_malloc(heap, n < 4 ? 0x70000000 : 0x8000000);
+        if (block == NULL) return 0;
+        blocks[n++] = block;
+        if (first == NULL) first = block;
+        if ((char *)block < first || (char *)block >= first + MAX_SEGMENT_SIZE) return n;
+    }
+    return 0;
+}
+
+/* Function: test_collect
+ * ----------------------
+ * Collects a heap holding a chain of blocks reached from a root only
+ * through pointers into the middle of each block, a handle block that
+ * points to one more, and garbage that points into the chain. Then
+ * collects a heap spilled into an overflow segment, where a root reaches
+ * the overflow block and that reaches back into the first segment.
+ */
+static void test_collect(void)
+{
+    enum { CHAIN = 100, GARBAGE = 200 };
+    static void *roots[4];
+    myheap_t *heap = myheap_create();
+    if (!check(heap != NULL, "myheap_create")) return;
+    check(myheap_add_root(heap, roots, sizeof(roots)), "myheap_add_root");
+    // each link holds its number and a pointer into the middle of the next one
+    void **next = NULL;
+    for (long i = CHAIN - 1; i >= 0; i--) {
+        void **link = myheap_malloc(heap, 64);
+        if (!check(link != NULL, "allocation")) return;
+        link[0] = next == NULL ? NULL : (char *)next + 24;
+        link[1] = (void *)i;
+        next = link;
+    }
+    roots[0] = (char *)next + 40;
+    for (int i = 0; i < GARBAGE; i++) {
+        void **junk = myheap_malloc(heap, 32 + i);
+        if (!check(junk != NULL, "allocation")) return;
+        junk[0] = next;
+        junk[1] = junk; // and a cycle of one
+    }
+    void **by_handle = myheap_malloc(heap, 48);
+    myhandle_t handle = myheap_handle_alloc(heap, 100);
+    if (!check(by_handle != NULL && handle != NULL, "allocation")) return;
+    by_handle[0] = (void *)0x5a5a;
+    *(void **)myhandle_lock(handle) = by_handle;
+    myhandle_unlock(handle);
+
+    check(myheap_collect(heap) == GARBAGE, "collection frees the unreachable blocks only");
+    check(myheap_validate(heap), "heap valid after collection");
+    long reached = 0;
+    for (char *p = (char *)roots[0] - 40; p != NULL; reached++) {
+        void **link = (void **)p;
+        if (!check(link[1] == (void *)reached, "chain kept by collection")) break;
+        p = link[0] == NULL ? NULL : (char *)link[0] - 24;
+    }
+    check(reached == CHAIN, "whole chain reached through interior pointers");
+    check(by_handle[0] == (void *)0x5a5a, "block of a handle kept with what it points to");
+
+    roots[0] = NULL;
+    check(myheap_collect(heap) == CHAIN, "chain collected once its root is gone");
+    myheap_handle_free(heap, handle);
+    check(myheap_collect(heap) == 1, "block collected once its handle is gone");
+    check(myheap_validate(heap), "heap valid after collecting it all");
+    myheap_destroy(heap);
+
+    static void *blocks[64];
+    heap = myheap_create();
+    if (!check(heap != NULL, "myheap_create")) return;
+    int n = fill_to_overflow(heap, blocks, 64);
+    if (!check(n > 1, "heap spilled into an overflow segment")) {
+        myheap_destroy(heap);
+        return;
+    }
+    void **spilled = blocks[n-1], **inside = blocks[n-2];
+    void *garbage = myheap_malloc(heap, 0x8000000);
+    check(garbage != NULL, "allocation after the spill");
+    spilled[1] = (void *)0x1234;
+    spilled[0] = (char *)inside + 4096;
+    inside[1] = (void *)0x4321;
+    check(myheap_add_root(heap, roots, sizeof(roots)), "myheap_add_root");
+    roots[0] = (char *)spilled + 8;
+    check(myheap_collect(heap) == (size_t)n - 2 + 1, "collection across the overflow segment");
+    check(myheap_validate(heap), "heap valid after collecting across segments");
+    check(spilled[1] == (void *)0x1234 && inside[1] == (void *)0x4321, "blocks reached across segments kept");
+    roots[0] = NULL;
+    myheap_destroy(heap);
+}
+
+/* Function: walk_records
+ * -----------------------
+ * Follows the list of records in heap from its root, each holding its
+ * number and the offset of the next one, and returns whether the n
+ * records are all there in order.
+ */
+static bool walk_records(myheap_t *heap, long n)
+{
+    long i = 0;
+    for (size_t *rec = myheap_root(heap); rec != NULL; rec = myheap_pointer(heap, rec[0]), i++)
+        if (rec[1] != (size_t)i) return false;
+    return i == n;
+}
+
+/* Function: test_heap_file
+ * ------------------------
+ * Keeps a list in a heap file, linked by offsets, and checks it is all
+ * there after the file is closed and opened again, both where it was and
+ * at another address when its old one is taken. The file cannot be opened
+ * twice at once.
+ */
+static void test_heap_file(void)
+{
+    enum { NRECORDS = 500 };
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/heaptest-%d.heap", (int)getpid());
+    unlink(path);
+    myheap_t *heap = myheap_open(path);
+    if (!check(heap != NULL, "myheap_open on a new file")) return;
+    size_t next = 0;
+    for (long i = NRECORDS - 1; i >= 0; i--) {
+        size_t *rec = myheap_malloc(heap, 16 + i % 200);
+        void *gap = myheap_malloc(heap, 100);
+        if (!check(rec != NULL && gap != NULL, "allocation in a heap file")) return;
+        if (i % 2) myheap_free(heap, gap); // free blocks between the records too
+        rec[0] = next;
+        rec[1] = i;
+        next = myheap_offset(heap, rec);
+    }
+    myheap_set_root(heap, myheap_pointer(heap, next));
+    check(myheap_open(path) == NULL, "heap file not opened twice");
+    char *first_at = (char *)heap;
+    check(myheap_close(heap), "myheap_close");
+
+    heap = myheap_open(path);
+    if (!check(heap != NULL, "myheap_open again")) return;
+    check((char *)heap == first_at, "heap file back at its address");
+    check(myheap_validate(heap), "heap file valid after reopening");
+    check(walk_records(heap, NRECORDS), "records kept in the heap file");
+    check(myheap_close(heap), "myheap_close");
+
+    // take the old address so that the file has to go elsewhere
+    void *taken = mmap(first_at, PAGE_SIZE, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED_NOREPLACE, -1, 0);
+    if (!check(taken == first_at, "old address of the heap taken")) return;
+    heap = myheap_open(path);
+    if (check(heap != NULL, "myheap_open at another address")) {
+        check((char *)heap != first_at, "heap file moved");
+        check(myheap_validate(heap), "moved heap file valid");
+        check(walk_records(heap, NRECORDS), "records kept in the moved heap file");
+        void *more = myheap_malloc(heap, 5000);
+        check(more != NULL && myheap_validate(heap), "moved heap file in use");
+        myheap_free(heap, more);
+        check(myheap_close(heap), "myheap_close");
+    }
+    munmap(taken, PAGE_SIZE);
+    heap = myheap_open(path);
+    if (check(heap != NULL, "myheap_open after the move")) {
+        check(walk_records(heap, NRECORDS) && myheap_validate(heap), "heap file kept after the move");
+        myheap_destroy(heap);
+    }
+    unlink(path);
+}
+
+/* Function: test_shared_heap
+ * --------------------------
+ * Opens a shared heap, hands a block to a forked child through the
+ * mapping it inherits, and checks that an object that was not set up as
+ * a heap, or was cut short, is not attached to. A build without shared
+ * heaps cannot open one, and skips the rest.
+ */
+static void test_shared_heap(void)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "/heaptest-%d", (int)getpid());
+    shm_unlink(name);
+    myheap_t *heap = myheap_open_shared(name);
+    if (heap == NULL) return;
+    check(myheap_validate(heap), "new shared heap valid");
+    char *block = myheap_malloc(heap, 1000);
+    check(block != NULL, "allocation in a shared heap");
+    strcpy(block, "parent");
+    pid_t child = fork();
+    if (child == 0) {
+        // the inherited pointer works, the object cannot be mapped a second time
+        bool ok = myheap_open_shared(name) == NULL && strcmp(block, "parent") == 0;
+        char *reply = myheap_malloc(heap, 500);
+        ok = ok && reply != NULL;
+        if (ok) strcpy(reply, "child");
+        myheap_free(heap, block);
+        myheap_set_root(heap, reply);
+        _exit(ok && myheap_validate(heap) ? 0 : 1);
+    }
+    int status;
+    check(child > 0 && waitpid(child, &status, 0) == child && WIFEXITED(status) && WEXITSTATUS(status) == 0,
+          "shared heap used by a forked child");
+    char *reply = myheap_root(heap);
+    check(reply != NULL && strcmp(reply, "child") == 0, "block from the child seen by the parent");
+    check(myheap_validate(heap), "shared heap valid after the child");
+    myheap_free(heap, reply);
+
+    // a copy of the front of the heap in an object of the wrong size
+    char front[PAGE_SIZE];
+    memcpy(front, heap, sizeof(front));
+    myheap_destroy(heap);
+    shm_unlink(name);
+    int fd = shm_open(name, O_RDWR|O_CREAT, 0600);
+    if (!check(fd != -1, "shm_open")) return;
+    check(ftruncate(fd, PAGE_SIZE) == 0 && pwrite(fd, front, sizeof(front), 0) == sizeof(front), "object written");
+    check(myheap_open_shared(name) == NULL, "object cut short not attached to");
+    check(ftruncate(fd, 0) == 0 && ftruncate(fd, MAX_SEGMENT_SIZE) == 0, "object zeroed");
+    check(myheap_open_shared(name) == NULL, "object not set up as a heap not attached to");
+    close(fd);
+    shm_unlink(name);
+}
+
+/* Function: test_overflow
+ * -----------------------
+ * Fills a heap into an overflow segment and asks it for aligned blocks,
+ * which then come from the overflow heap and have to be split there, and
+ * for blocks with a hint, then frees them all through the first heap.
+ */
+static void test_overflow(void)
+{
+    static void *blocks[64];
+    myheap_t *heap = myheap_create();
+    if (!check(heap != NULL, "myheap_create")) return;
+    int n = fill_to_overflow(heap, blocks, 64);
+    if (!check(n > 0, "heap spilled into an overflow segment")) {
+        myheap_destroy(heap);
+        return;
+    }
+    void *aligned[4];
+    for (int i = 0; i < 4; i++) {
+        size_t alignment = (size_t)1 << (16 + i);
+        aligned[i] = myheap_memalign(heap, alignment, 0x6000000);
+        check(aligned[i] != NULL && (uintptr_t)aligned[i] % alignment == 0, "memalign from the overflow heap");
+        if (aligned[i] != NULL) memset(aligned[i], i, 4096);
+    }
+    void *near = myheap_malloc_hint(heap, 1000, ALLOC_SHORT_LIVED, blocks[n-1]);
+    void *moved = myheap_realloc(heap, blocks[n-1], 0x9000000);
+    check(near != NULL && moved != NULL, "hint and realloc in the overflow heap");
+    check(myheap_validate(heap), "heap valid with aligned blocks in overflow");
+    for (int i = 0; i < 4; i++) myheap_free(heap, aligned[i]);
+    myheap_free(heap, near);
+    myheap_free(heap, moved);
+    for (int i = 0; i < n - 1; i++) myheap_free(heap, blocks[i]);
+    check(myheap_validate(heap), "heap valid after freeing the overflow");
+    myheap_destroy(heap);
+}
+
+int main(void)
+{
+    test_heaps();
+    test_regions();
+    test_compaction();
+    test_collect();
+    test_overflow();
+    test_heap_file();
+    test_shared_heap();
+    test_default_heap();
+    printf("%s\n", failures == 0 ? "All tests passed" : "Some tests failed");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,100 @@
+/*
+ * File: keymap.c
+ * --------------
+ * The hash table of keymap.h. Keys are spread with Fibonacci hashing, the
+ * top bits of the key times 2^64 over the golden ratio, which scatters
+ * consecutive ids and aligned addresses alike.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "keymap.h"
+
+// entries of a table when it is first made, a power of two
+#define INITIAL_CAPACITY 1024
+
+/**
+ * Returns the entry where a probe for key starts in map
+ */
+static inline size_t home_of(const keymap_t *map, uintptr_t key)
+{
+    return (uint64_t)key * 0x9e3779b97f4a7c15UL >> (64 - __builtin_ctzl(map->capacity));
+}
+
+/**
+ * Returns the entry of key in map, or the empty entry where it would go
+ */
+static size_t find(const keymap_t *map, uintptr_t key)
+{
+    size_t mask = map->capacity - 1;
+    size_t i = home_of(map, key);
+    while (map->keys[i] != KEYMAP_EMPTY && map->keys[i] != key)
+        i = (i + 1) & mask;
+    return i;
+}
+
+/**
+ * Doubles the entries of map, or makes its first ones. Returns false if
+ * out of memory, leaving map as it was.
+ */
+static bool grow(keymap_t *map)
+{
+    keymap_t bigger = {.capacity = map->capacity ? 2*map->capacity : INITIAL_CAPACITY, .count = map->count};
+    bigger.keys = malloc(bigger.capacity*sizeof(uintptr_t));
+    bigger.values = malloc(bigger.capacity*sizeof(int));
+    if (!bigger.keys || !bigger.values) {
+        free(bigger.keys);
+        free(bigger.values);
+        return false;
+    }
+    memset(bigger.keys, 0xff, bigger.capacity*sizeof(uintptr_t));  // all KEYMAP_EMPTY
+    for (size_t i = 0; i < map->capacity; i++) {
+        if (map->keys[i] == KEYMAP_EMPTY) continue;
+        size_t j = find(&bigger, map->keys[i]);
+        bigger.keys[j] = map->keys[i];
+        bigger.values[j] = map->values[i];
+    }
+    free(map->keys);
+    free(map->values);
+    *map = bigger;
+    return true;
+}
+
+int *keymap_insert(keymap_t *map, uintptr_t key, bool *added)
+{
+    if (2*(map->count + 1) > map->capacity && !grow(map)) return NULL;
+    size_t i = find(map, key);
+    *added = map->keys[i] == KEYMAP_EMPTY;
+    if (*added) {
+        map->keys[i] = key;
+        map->count++;
+    }
+    return &map->values[i];
+}
+
+bool keymap_remove(keymap_t *map, uintptr_t key, int *value)
+{
+    if (map->capacity == 0) return false;
+    size_t mask = map->capacity - 1, i = find(map, key);
+    if (map->keys[i] == KEYMAP_EMPTY) return false;
+    *value = map->values[i];
+    for (size_t j = (i + 1) & mask; map->keys[j] != KEYMAP_EMPTY; j = (j + 1) & mask) {
+        size_t home = home_of(map, map->keys[j]);
+        // entry j can fill the gap at i unless its home lies in (i, j]
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            map->keys[i] = map->keys[j];
+            map->values[i] = map->values[j];
+            i = j;
+        }
+    }
+    map->keys[i] = KEYMAP_EMPTY;
+    map->count--;
+    return true;
+}
+
+void keymap_release(keymap_t *map)
+{
+    free(map->keys);
+    free(map->values);
+    *map = (keymap_t){0};
+}
@@ -0,0 +1,57 @@
+/* File: keymap.h
+ * --------------
+ * Interface file for a hash table from keys to ints, used to number the
+ * blocks of a script: by their ids in a streamed script, and by their
+ * addresses in a recording. Keys are ids or addresses, anything but
+ * KEYMAP_EMPTY.
+ */
+#ifndef _KEYMAP_H
+#define _KEYMAP_H
+
+#include <stdbool.h> // for bool
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uintptr_t
+
+// the key of an empty entry, which cannot be entered
+#define KEYMAP_EMPTY UINTPTR_MAX
+
+/* Type: keymap_t
+ * --------------
+ * Open addressing with linear probing on a power of two entries, kept
+ * under half full, so that a lookup is one or two probes. Removal shifts
+ * back the entries that follow instead of leaving tombstones. A keymap_t
+ * must be zeroed before first use. The fields are private to keymap.c.
+ */
+typedef struct {
+    uintptr_t *keys;    // key of each entry, KEYMAP_EMPTY if none
+    int *values;        // value of each entry
+    size_t capacity;    // entries, 0 until the first insertion
+    size_t count;       // entries in use
+} keymap_t;
+
+
+/* Function: keymap_insert
+ * -----------------------
+ * Returns where the value of key is kept in map, entering key if it is not
+ * there yet, in which case added is set and the value is left for the
+ * caller to fill in. Returns NULL if out of memory to enter it. The
+ * pointer is only good until the next insertion or removal.
+ */
+int *keymap_insert(keymap_t *map, uintptr_t key, bool *added);
+
+
+/* Function: keymap_remove
+ * -----------------------
+ * Removes key from map, storing its value in value. Returns false if key
+ * was not there.
+ */
+bool keymap_remove(keymap_t *map, uintptr_t key, int *value);
+
+
+/* Function: keymap_release
+ * ------------------------
+ * Frees the entries of map and leaves it empty.
+ */
+void keymap_release(keymap_t *map);
+
+#endif
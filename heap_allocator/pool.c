@@ -0,0 +1,81 @@
+/*
+ * File: pool.c
+ * ------------
+ * Object pools on top of the main heap. Each slab is a single mymalloc
+ * block holding a slab header and slab_slots slots. Slots of a new slab are
+ * handed out in address order by bumping a pointer, so a slab is not
+ * walked to build a free list when it is made, and only freed slots go on
+ * the free list.
+ */
+
+#include <stdint.h>
+#include "pool.h"
+#include "allocator.h"
+
+// Alignment of the blocks returned by mymalloc
+#define HEAP_ALIGNMENT 8
+// Slabs are sized to hold about this many bytes of slots, but at least
+// MIN_SLAB_SLOTS slots
+#define SLAB_BYTES (16*1024)
+#define MIN_SLAB_SLOTS 8
+
+// Each slab starts with this header, the slots follow it aligned
+struct pool_slab {
+    pool_slab *next;  // next older slab
+};
+
+static inline size_t roundup(size_t sz, size_t mult)
+{
+    return (sz + mult-1) & ~(mult-1);
+}
+
+mypool_t *mypool_create(size_t objsize, size_t align)
+{
+    if (align == 0) align = HEAP_ALIGNMENT;
+    if ((align & (align-1)) != 0 || objsize == 0 || objsize > SIZE_MAX/(2*MIN_SLAB_SLOTS)) return NULL;
+    mypool_t *pool = mymalloc(sizeof(mypool_t));
+    if (pool == NULL) return NULL;
+    // a free slot holds the link to the next one, so it is sized and aligned for it
+    if (objsize < sizeof(void *)) objsize = sizeof(void *);
+    if (align < __alignof__(void *)) align = __alignof__(void *);
+    pool->slot_size = roundup(objsize, align);
+    pool->align = align;
+    pool->slab_slots = SLAB_BYTES/pool->slot_size;
+    if (pool->slab_slots < MIN_SLAB_SLOTS) pool->slab_slots = MIN_SLAB_SLOTS;
+    pool->free = NULL;
+    pool->next = pool->end = NULL;
+    pool->slabs = NULL;
+    return pool;
+}
+
+/**
+ * Function: mypool_grow
+ * ---------------------
+ * Only called once the free list and the newest slab are both used up,
+ * so the slab being replaced has nothing left to hand out. A slab with an
+ * alignment above the one of mymalloc gets room to move its first slot
+ * up to the alignment.
+ */
+void *mypool_grow(mypool_t *pool)
+{
+    size_t slack = pool->align > HEAP_ALIGNMENT ? pool->align - HEAP_ALIGNMENT : 0;
+    pool_slab *slab = mymalloc(sizeof(pool_slab) + slack + pool->slab_slots*pool->slot_size);
+    if (slab == NULL) return NULL;
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    uintptr_t first = roundup((uintptr_t)slab + sizeof(pool_slab), pool->align);
+    pool->next = (char *)first + pool->slot_size;
+    pool->end = (char *)first + pool->slab_slots*pool->slot_size;
+    return (void *)first;
+}
+
+void mypool_destroy(mypool_t *pool)
+{
+    pool_slab *slab = pool->slabs;
+    while (slab != NULL) {
+        pool_slab *next = slab->next;
+        myfree(slab);
+        slab = next;
+    }
+    myfree(pool);
+}
@@ -0,0 +1,100 @@
+/* File: pool.h
+ * ------------
+ * Interface file for object pools. A pool hands out slots of one fixed
+ * size, carved from slabs taken from the main heap. Freed slots go on a
+ * LIFO free list and are handed out again first, so allocation and free
+ * are a few instructions and objects of a kind stay packed together.
+ */
+#ifndef _POOL_H
+#define _POOL_H
+
+#include <stddef.h>  // for size_t
+#include <stdbool.h> // for bool
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct pool_slab pool_slab;
+
+/* Type: mypool_t
+ * --------------
+ * Everything the fast paths of mypool_alloc and mypool_free need is kept
+ * in the pool itself. The fields are private to pool.c and the inline
+ * functions.
+ */
+typedef struct {
+    void *free;          // most recently freed slot, each links to the next
+    char *next;          // first slot of the newest slab never handed out
+    char *end;           // end of the slots of the newest slab
+    pool_slab *slabs;    // all slabs of the pool, newest first
+    size_t slot_size;    // object size rounded up to the alignment
+    size_t align;        // alignment of every slot
+    size_t slab_slots;   // slots in each slab
+} mypool_t;
+
+
+/* Function: mypool_create
+ * -----------------------
+ * Makes a new empty pool for objects of objsize bytes aligned to align,
+ * which must be a power of 2 (0 means the mymalloc alignment). A free
+ * slot holds a pointer, so slots are aligned to a pointer at least.
+ * Returns NULL if the arguments are invalid or the main heap is out of
+ * memory.
+ */
+mypool_t *mypool_create(size_t objsize, size_t align);
+
+
+/* Function: mypool_grow
+ * ---------------------
+ * Called by mypool_alloc when there is no free slot left. Takes a new
+ * slab from the main heap and returns its first slot, or NULL if the
+ * main heap is out of memory.
+ */
+void *mypool_grow(mypool_t *pool);
+
+
+/* Function: mypool_alloc
+ * ----------------------
+ * Returns a slot from the pool, the one freed most recently if any.
+ */
+static inline void *mypool_alloc(mypool_t *pool)
+{
+    void *slot = pool->free;
+    if (slot != NULL) {
+        pool->free = *(void **)slot;
+        return slot;
+    }
+    if (pool->next < pool->end) {
+        slot = pool->next;
+        pool->next += pool->slot_size;
+        return slot;
+    }
+    return mypool_grow(pool);
+}
+
+
+/* Function: mypool_free
+ * ---------------------
+ * Gives a slot back to the pool it came from.
+ */
+static inline void mypool_free(mypool_t *pool, void *slot)
+{
+    if (slot == NULL) return;
+    *(void **)slot = pool->free;
+    pool->free = slot;
+}
+
+
+/* Function: mypool_destroy
+ * ------------------------
+ * Gives every slab of the pool and the pool itself back to the main
+ * heap, whether the slots were freed or not.
+ */
+void mypool_destroy(mypool_t *pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,175 @@
+/*
+ * File: preload.c
+ * ---------------
+ * Exports the standard malloc family on top of the allocator, to build
+ * libmyalloc.so. Loading it with
+ *
+ *     LD_PRELOAD=./libmyalloc.so program
+ *
+ * makes an unmodified program allocate from the default heap. A single
+ * lock serializes all calls, and the heap is set up on the first call.
+ * The C library promises blocks aligned for any type, which is 16 bytes
+ * on 64-bit targets. The allocator in libmyalloc.so is built with payloads
+ * on 16 bytes, so blocks come straight from mymalloc. Only the memalign
+ * family, and blocks from an allocator built otherwise that fall short of
+ * 16 bytes, go through mymemalign, which pays for padding and a split.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "allocator.h"
+
+// same as the C library, 16 bytes on 64-bit targets
+#define MALLOC_ALIGNMENT (2*sizeof(size_t))
+
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool heap_ready = false;
+
+// The lock is held across fork so that the child gets a consistent heap
+static void lock_heap(void) { pthread_mutex_lock(&heap_lock); }
+static void unlock_heap(void) { pthread_mutex_unlock(&heap_lock); }
+
+/**
+ * Takes the lock, setting up the heap on the first call. Returns false,
+ * without the lock, if the heap cannot be set up.
+ */
+static bool enter(void)
+{
+    lock_heap();
+    if (heap_ready) return true;
+    if (!myinit()) {
+        unlock_heap();
+        return false;
+    }
+    heap_ready = true;
+    // registering may itself call malloc, so not with the lock held
+    unlock_heap();
+    pthread_atfork(lock_heap, unlock_heap, unlock_heap);
+    lock_heap();
+    return true;
+}
+
+/**
+ * Allocates with the lock held, setting errno when out of memory
+ */
+static void *allocate(size_t alignment, size_t size)
+{
+    if (alignment < MALLOC_ALIGNMENT) alignment = MALLOC_ALIGNMENT;
+    if (size == 0) size = 1;
+    void *ptr = alignment > MALLOC_ALIGNMENT ? mymemalign(alignment, size) : mymalloc(size);
+    if (ptr != NULL && ((uintptr_t)ptr & (alignment-1)) != 0) {
+        // freed after the aligned block is placed, so that it is not reused for it
+        void *unaligned = ptr;
+        ptr = mymemalign(alignment, size);
+        myfree(unaligned);
+    }
+    if (ptr == NULL) errno = ENOMEM;
+    return ptr;
+}
+
+void *malloc(size_t size)
+{
+    if (!enter()) return NULL;
+    void *ptr = allocate(MALLOC_ALIGNMENT, size);
+    unlock_heap();
+    return ptr;
+}
+
+void free(void *ptr)
+{
+    if (ptr == NULL) return;
+    lock_heap();
+    myfree(ptr);
+    unlock_heap();
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    if (size != 0 && nmemb > SIZE_MAX/size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    void *ptr = malloc(nmemb*size);
+    if (ptr != NULL) memset(ptr, 0, nmemb*size);
+    return ptr;
+}
+
+/**
+ * A block is resized in place when it can be, otherwise it moves to a
+ * new block that keeps the alignment of malloc
+ */
+void *realloc(void *ptr, size_t size)
+{
+    if (ptr == NULL) return malloc(size);
+    if (size == 0) {
+        free(ptr);
+        return NULL;
+    }
+    if (!enter()) return NULL;
+    void *newptr = ptr;
+    if (!myresize(ptr, size)) {
+        newptr = allocate(MALLOC_ALIGNMENT, size);
+        if (newptr != NULL) {
+            size_t oldsz = mymalloc_usable_size(ptr);
+            memcpy(newptr, ptr, oldsz < size ? oldsz : size);
+            myfree(ptr);
+        }
+    }
+    unlock_heap();
+    return newptr;
+}
+
+void *reallocarray(void *ptr, size_t nmemb, size_t size)
+{
+    if (size != 0 && nmemb > SIZE_MAX/size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return realloc(ptr, nmemb*size);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    if (alignment == 0 || (alignment & (alignment-1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (!enter()) return NULL;
+    void *ptr = allocate(alignment, size);
+    unlock_heap();
+    return ptr;
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    if (alignment < sizeof(void *) || (alignment & (alignment-1)) != 0) return EINVAL;
+    void *ptr = memalign(alignment, size);
+    if (ptr == NULL) return ENOMEM;
+    *memptr = ptr;
+    return 0;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    return memalign(alignment, size);
+}
+
+void *valloc(size_t size)
+{
+    return memalign(sysconf(_SC_PAGESIZE), size);
+}
+
+void *pvalloc(size_t size)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    return memalign(page, (size + page-1) & ~(page-1));
+}
+
+size_t malloc_usable_size(void *ptr)
+{
+    return mymalloc_usable_size(ptr);
+}
@@ -0,0 +1,624 @@
+/*
+ * File: record.c
+ * --------------
+ * Records the allocations of a running program as an alloctest script, to
+ * build librecord.so. Loading it with
+ *
+ *     MYALLOC_RECORD=out.trace LD_PRELOAD=./librecord.so program
+ *
+ * passes every call of the malloc family on to the allocator underneath
+ * (found with dlsym RTLD_NEXT) and logs it to out.trace, as a binary trace
+ * or as a text script if the name ends in .script (see script.h). Without
+ * MYALLOC_RECORD set nothing is recorded. The file is locked while it is
+ * written, so programs the process executes, which inherit the setting,
+ * find it taken and are not recorded, unless the name holds %p, which is
+ * replaced by the process id to give each its own file.
+ *
+ * Each thread logs its calls into a ring of its own, with no lock, and a
+ * writer thread drains the rings in the background, puts the calls in
+ * order, gives each block an id and writes the requests out. The order is
+ * that of a sequence number taken from one counter, before a block is
+ * given up (free, or realloc of the old block) and after one is obtained
+ * (malloc, or realloc of the new block), so that an address freed in one
+ * thread and reused in another is always freed first in the script. Ids
+ * are recycled once freed, so they only number as many as the blocks live
+ * at once. A thread whose ring is full waits for the writer.
+ *
+ * Blocks allocated before recording starts are not known, their frees are
+ * left out and a realloc of one becomes an allocation. Alignment is not
+ * recorded, memalign and the rest are allocations of the size asked for,
+ * and requests over INT_MAX bytes, which scripts cannot hold, are left out.
+ * A child process after fork is not recorded.
+ */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include "keymap.h"
+#include "script.h"
+
+// events in the ring of a thread, a power of two
+#define RING_SIZE (1 << 14)
+
+// sequence number of no call, for a thread not inside one
+#define IDLE UINT64_MAX
+
+// how long the writer sleeps when the rings are empty, in nanoseconds
+#define WRITER_NAP 1000000
+
+// bytes given out while the functions underneath are being looked up
+#define BOOTSTRAP_SIZE (1 << 16)
+
+// an event in a ring, a request on a block address, or the old block of a
+// realloc being given up
+enum { RELEASE = REALLOC + 1 };
+typedef struct {
+    uint64_t seq;
+    uintptr_t ptr;
+    size_t size;
+    int op;
+} event_t;
+
+typedef struct ring {
+    event_t events[RING_SIZE];
+    uint64_t head;          // events pushed, written by the thread only
+    uint64_t tail;          // events taken, written by the writer only
+    uint64_t end;           // head as the writer last read it
+    uint64_t busy;          // at most the sequence number of the call in progress, or IDLE
+    bool owned;             // a thread is logging into this ring
+    struct ring *next;      // all rings ever made, pushed on the front
+    int release_id;         // id the realloc in progress gave up, for the writer
+} ring_t;
+
+// the functions underneath
+static struct {
+    void *(*malloc)(size_t);
+    void (*free)(void *);
+    void *(*calloc)(size_t, size_t);
+    void *(*realloc)(void *, size_t);
+    void *(*memalign)(size_t, size_t);
+    int (*posix_memalign)(void **, size_t, size_t);
+    void *(*aligned_alloc)(size_t, size_t);
+} real;
+
+static bool recording;
+static uint64_t next_seq;
+static ring_t *rings;
+static pthread_key_t ring_key;
+static pthread_t writer;
+static bool stopping;
+
+// the writer's state, out_lock is held while writing and across fork
+static pthread_mutex_t out_lock = PTHREAD_MUTEX_INITIALIZER;
+static trace_writer_t out;
+static ring_t **merge;          // rings with events to write, see write_pass
+static size_t merge_capacity;
+
+static keymap_t live;           // ids of the live blocks by address
+static int *free_ids, nfree, free_capacity, num_ids;
+static bool broken;             // out of memory, events are drained and dropped
+
+// ring of this thread, and whether its calls pass through unrecorded: in
+// the writer, and while looking up the functions underneath or a ring
+static __thread ring_t *my_ring __attribute__((tls_model("initial-exec")));
+static __thread bool inside __attribute__((tls_model("initial-exec")));
+
+static char bootstrap[BOOTSTRAP_SIZE] __attribute__((aligned(16)));
+static size_t bootstrap_used;
+
+
+/**
+ * Looks up the functions underneath. dlsym may itself allocate, which is
+ * served from the bootstrap buffer meanwhile.
+ */
+static void resolve(void)
+{
+    if (inside) return;
+    inside = true;
+    real.calloc = dlsym(RTLD_NEXT, "calloc");
+    real.free = dlsym(RTLD_NEXT, "free");
+    real.realloc = dlsym(RTLD_NEXT, "realloc");
+    real.memalign = dlsym(RTLD_NEXT, "memalign");
+    real.posix_memalign = dlsym(RTLD_NEXT, "posix_memalign");
+    real.aligned_alloc = dlsym(RTLD_NEXT, "aligned_alloc");
+    real.malloc = dlsym(RTLD_NEXT, "malloc");
+    inside = false;
+}
+
+/**
+ * Allocates from the bootstrap buffer, 16-byte aligned and zeroed, with
+ * the size kept in the 16 bytes before the block for realloc
+ */
+static void *bootstrap_alloc(size_t size)
+{
+    size = (size + 31) & ~(size_t)15;
+    size_t used = __atomic_fetch_add(&bootstrap_used, size, __ATOMIC_RELAXED);
+    if (used + size > BOOTSTRAP_SIZE) return NULL;
+    *(size_t *)(bootstrap + used) = size - 16;
+    return bootstrap + used + 16;
+}
+
+static bool in_bootstrap(void *ptr)
+{
+    return (char *)ptr >= bootstrap && (char *)ptr < bootstrap + BOOTSTRAP_SIZE;
+}
+
+/* Function: release_ring
+ * ----------------------
+ * Gives up the ring of an exiting thread, for another to take.
+ */
+static void release_ring(void *ring)
+{
+    __atomic_store_n(&((ring_t *)ring)->owned, false, __ATOMIC_RELEASE);
+    my_ring = NULL;
+}
+
+/**
+ * Returns the ring of this thread, taking one given up by an exited thread
+ * or else making a new one. Returns NULL if this call is not recorded.
+ */
+static ring_t *enter(void)
+{
+    if (!__atomic_load_n(&recording, __ATOMIC_RELAXED) || inside) return NULL;
+    if (my_ring) return my_ring;
+    inside = true;
+    ring_t *ring;
+    for (ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next) {
+        bool unowned = false;
+        if (__atomic_compare_exchange_n(&ring->owned, &unowned, true, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+    }
+    if (ring == NULL) {
+        ring = mmap(NULL, sizeof(ring_t), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ring == MAP_FAILED) {
+            inside = false;
+            return NULL;
+        }
+        ring->busy = IDLE;
+        ring->owned = true;
+        ring->release_id = -1;
+        ring->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&rings, &ring->next, ring, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            ;
+    }
+    pthread_setspecific(ring_key, ring);
+    my_ring = ring;
+    inside = false;
+    return ring;
+}
+
+/**
+ * Marks the start of a call. The sequence numbers it takes are all at
+ * least the one stored in busy, which holds back the writer from them.
+ */
+static void begin(ring_t *ring)
+{
+    __atomic_store_n(&ring->busy, __atomic_load_n(&next_seq, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+}
+
+static uint64_t take_seq(void)
+{
+    return __atomic_fetch_add(&next_seq, 1, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Pushes an event on the ring of this thread, yielding to the writer while
+ * it is full
+ */
+static void push(ring_t *ring, int op, uint64_t seq, void *ptr, size_t size)
+{
+    uint64_t head = ring->head;
+    while (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == RING_SIZE)
+        sched_yield();
+    ring->events[head & (RING_SIZE-1)] = (event_t){.seq = seq, .ptr = (uintptr_t)ptr, .size = size, .op = op};
+    __atomic_store_n(&ring->head, head+1, __ATOMIC_RELEASE);
+}
+
+static void end(ring_t *ring)
+{
+    __atomic_store_n(&ring->busy, IDLE, __ATOMIC_SEQ_CST);
+}
+
+
+// Functions of the writer thread
+
+/* Function: out_of_memory
+ * -----------------------
+ * Stops recording. The rings are still drained, to let the threads go on.
+ */
+static void out_of_memory(void)
+{
+    fprintf(stderr, "librecord: out of memory, recording stopped.\n");
+    __atomic_store_n(&recording, false, __ATOMIC_RELEASE);
+    broken = true;
+}
+
+/* Function: put
+ * -------------
+ * Writes one request of the script.
+ */
+static void put(int op, int id, size_t size)
+{
+    request_t req = {.op = op, .id = id, .size = size};
+    trace_put(&out, &req);
+}
+
+/* Function: give_id
+ * -----------------
+ * Recycles the id of a block freed.
+ */
+static void give_id(int id)
+{
+    if (nfree == free_capacity) {
+        int capacity = free_capacity ? 2*free_capacity : 1024;
+        int *ids = realloc(free_ids, capacity*sizeof(int));
+        if (!ids) {
+            out_of_memory();
+            return;
+        }
+        free_ids = ids;
+        free_capacity = capacity;
+    }
+    free_ids[nfree++] = id;
+}
+
+/* Function: new_id
+ * ----------------
+ * Takes a recycled id or a fresh one.
+ */
+static int new_id(void)
+{
+    return nfree > 0 ? free_ids[--nfree] : num_ids++;
+}
+
+/* Function: map_add
+ * -----------------
+ * Enters ptr in the table with id, over any id it had.
+ */
+static void map_add(uintptr_t ptr, int id)
+{
+    bool added;
+    int *entry = keymap_insert(&live, ptr, &added);
+    if (!entry) {
+        out_of_memory();
+        return;
+    }
+    if (!added) {   // freed by a call not recorded, e.g. inside the C library
+        put(FREE, *entry, 0);
+        give_id(*entry);
+    }
+    *entry = id;
+}
+
+/* Function: map_remove
+ * --------------------
+ * Removes ptr from the table. Returns its id, or -1 if it was not there.
+ */
+static int map_remove(uintptr_t ptr)
+{
+    int id;
+    return keymap_remove(&live, ptr, &id) ? id : -1;
+}
+
+/**
+ * Writes out one event, in sequence order. The old block of a realloc is
+ * given up first, and its id is kept on the thread's ring for the new one.
+ */
+static void write_event(const event_t *ev, ring_t *ring)
+{
+    int id;
+    if (broken) return;
+    switch (ev->op) {
+        case ALLOC:
+            if (ev->ptr == 0 || ev->size > INT_MAX) break;
+            id = new_id();
+            map_add(ev->ptr, id);
+            put(ALLOC, id, ev->size);
+            break;
+        case FREE:
+            if ((id = map_remove(ev->ptr)) < 0) break;
+            put(FREE, id, 0);
+            give_id(id);
+            break;
+        case RELEASE:
+            ring->release_id = map_remove(ev->ptr);
+            break;
+        case REALLOC:
+            id = ring->release_id;
+            ring->release_id = -1;
+            if (ev->size > INT_MAX) {
+                if (id >= 0) {
+                    put(FREE, id, 0);
+                    give_id(id);
+                }
+            } else if (id < 0) {
+                id = new_id();
+                map_add(ev->ptr, id);
+                put(ALLOC, id, ev->size);
+            } else {
+                map_add(ev->ptr, id);
+                put(REALLOC, id, ev->size);
+            }
+            break;
+    }
+}
+
+/* Function: next_event
+ * --------------------
+ * Returns the next event of a ring, which must have one.
+ */
+static const event_t *next_event(const ring_t *ring)
+{
+    return &ring->events[ring->tail & (RING_SIZE-1)];
+}
+
+/* Function: sift_down
+ * -------------------
+ * Restores the heap of rings ordered by next event from entry i.
+ */
+static void sift_down(ring_t **heap, size_t n, size_t i)
+{
+    ring_t *ring = heap[i];
+    for (size_t child; (child = 2*i + 1) < n; i = child) {
+        if (child + 1 < n && next_event(heap[child+1])->seq < next_event(heap[child])->seq) child++;
+        if (next_event(heap[child])->seq >= next_event(ring)->seq) break;
+        heap[i] = heap[child];
+    }
+    heap[i] = ring;
+}
+
+/**
+ * Writes out from the rings, in order, the events that can no longer be
+ * preceded by one still to come: those below the sequence counter and
+ * below the calls in progress, which were read first. The rings are merged
+ * through a heap ordered by their next events. Later events stay in the
+ * rings for the next pass. Returns the number written.
+ */
+static size_t write_pass(bool last)
+{
+    uint64_t horizon = last ? IDLE : __atomic_load_n(&next_seq, __ATOMIC_SEQ_CST);
+    ring_t *first = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+    size_t nrings = 0;
+    for (ring_t *ring = first; ring != NULL; ring = ring->next) {
+        uint64_t busy = __atomic_load_n(&ring->busy, __ATOMIC_SEQ_CST);
+        if (busy < horizon && !last) horizon = busy;
+        nrings++;
+    }
+    if (nrings > merge_capacity) {
+        ring_t **more = realloc(merge, nrings*sizeof(ring_t *));
+        if (!more) {
+            out_of_memory();
+            return 0;
+        }
+        merge = more;
+        merge_capacity = nrings;
+    }
+
+    // the heads are read once, events pushed meanwhile wait for the next pass
+    size_t n = 0, written = 0;
+    for (ring_t *ring = first; ring != NULL; ring = ring->next) {
+        ring->end = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (ring->tail < ring->end && next_event(ring)->seq < horizon) merge[n++] = ring;
+    }
+    for (size_t i = n/2; i-- > 0; )
+        sift_down(merge, n, i);
+
+    pthread_mutex_lock(&out_lock);
+    while (n > 0) {
+        ring_t *ring = merge[0];
+        write_event(next_event(ring), ring);
+        __atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+        written++;
+        if (ring->tail == ring->end || next_event(ring)->seq >= horizon) merge[0] = merge[--n];
+        if (n > 0) sift_down(merge, n, 0);
+    }
+    pthread_mutex_unlock(&out_lock);
+    return written;
+}
+
+static void *write_events(void *arg)
+{
+    inside = true;
+    while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+        if (write_pass(false) == 0) {
+            struct timespec nap = {.tv_nsec = WRITER_NAP};
+            nanosleep(&nap, NULL);
+        }
+    }
+    write_pass(true);
+    return NULL;
+}
+
+// The output is flushed before fork and held, so the child has nothing of
+// it buffered to write again, and the child records nothing
+static void before_fork(void)
+{
+    pthread_mutex_lock(&out_lock);
+    fflush(out.fp);
+}
+static void after_fork(void) { pthread_mutex_unlock(&out_lock); }
+static void in_child(void)
+{
+    recording = false;
+    pthread_mutex_unlock(&out_lock);
+}
+
+__attribute__((constructor))
+static void start_recording(void)
+{
+    const char *name = getenv("MYALLOC_RECORD");
+    if (name == NULL || real.malloc == NULL) resolve();
+    if (name == NULL || real.malloc == NULL) return;
+    inside = true;   // the recorder's own allocations are not recorded
+    char path[PATH_MAX];
+    const char *pid = strstr(name, "%p");
+    if (pid)
+        snprintf(path, sizeof(path), "%.*s%d%s", (int)(pid - name), name, (int)getpid(), pid + 2);
+    else
+        snprintf(path, sizeof(path), "%s", name);
+    // the lock is taken before the file is truncated, and kept till exit
+    int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0666);
+    if (fd < 0 || flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        if (errno != EWOULDBLOCK)
+            fprintf(stderr, "librecord: could not create \"%s\", not recording.\n", path);
+        if (fd >= 0) close(fd);
+        inside = false;
+        return;
+    }
+    if (!trace_open(&out, path)) {
+        fprintf(stderr, "librecord: could not create \"%s\", not recording.\n", path);
+        inside = false;
+        return;
+    }
+    pthread_key_create(&ring_key, release_ring);
+    pthread_atfork(before_fork, after_fork, in_child);
+    __atomic_store_n(&recording, true, __ATOMIC_RELEASE);
+    if (pthread_create(&writer, NULL, write_events, NULL) != 0) {
+        fprintf(stderr, "librecord: could not start the writer, not recording.\n");
+        recording = false;
+    }
+    inside = false;
+}
+
+__attribute__((destructor))
+static void stop_recording(void)
+{
+    if (!__atomic_load_n(&recording, __ATOMIC_ACQUIRE)) return;
+    __atomic_store_n(&recording, false, __ATOMIC_RELEASE);
+    __atomic_store_n(&stopping, true, __ATOMIC_RELEASE);
+    pthread_join(writer, NULL);
+    if (!trace_close(&out) || broken)
+        fprintf(stderr, "librecord: could not write the recording.\n");
+}
+
+
+// The malloc family, recorded
+
+void *malloc(size_t size)
+{
+    if (real.malloc == NULL) resolve();
+    if (real.malloc == NULL) return bootstrap_alloc(size);
+    ring_t *ring = enter();
+    if (ring == NULL) return real.malloc(size);
+    begin(ring);
+    void *ptr = real.malloc(size);
+    push(ring, ALLOC, take_seq(), ptr, size);
+    end(ring);
+    return ptr;
+}
+
+void free(void *ptr)
+{
+    if (ptr == NULL || in_bootstrap(ptr)) return;
+    ring_t *ring = enter();
+    if (ring == NULL) {
+        real.free(ptr);
+        return;
+    }
+    begin(ring);
+    push(ring, FREE, take_seq(), ptr, 0);
+    real.free(ptr);
+    end(ring);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    if (real.calloc == NULL) resolve();
+    if (real.calloc == NULL) {
+        if (size != 0 && nmemb > SIZE_MAX/size) return NULL;
+        return bootstrap_alloc(nmemb*size);
+    }
+    ring_t *ring = enter();
+    if (ring == NULL) return real.calloc(nmemb, size);
+    begin(ring);
+    void *ptr = real.calloc(nmemb, size);
+    push(ring, ALLOC, take_seq(), ptr, nmemb*size);
+    end(ring);
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    if (real.realloc == NULL) resolve();
+    if (in_bootstrap(ptr) || real.realloc == NULL) {
+        void *newptr = real.malloc ? malloc(size) : bootstrap_alloc(size);
+        if (newptr && ptr) {
+            size_t oldsz = ((size_t *)ptr)[-2];
+            memcpy(newptr, ptr, oldsz < size ? oldsz : size);
+        }
+        return newptr;
+    }
+    if (ptr == NULL) return malloc(size);
+    ring_t *ring = enter();
+    if (ring == NULL) return real.realloc(ptr, size);
+    begin(ring);
+    uint64_t seq = take_seq();
+    void *newptr = real.realloc(ptr, size);
+    if (newptr != NULL) {
+        push(ring, RELEASE, seq, ptr, 0);
+        push(ring, REALLOC, take_seq(), newptr, size);
+    } else if (size == 0) {    // freed
+        push(ring, FREE, seq, ptr, 0);
+    }
+    end(ring);
+    return newptr;
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    if (real.memalign == NULL) resolve();
+    ring_t *ring = enter();
+    if (ring == NULL) return real.memalign(alignment, size);
+    begin(ring);
+    void *ptr = real.memalign(alignment, size);
+    push(ring, ALLOC, take_seq(), ptr, size);
+    end(ring);
+    return ptr;
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    if (real.posix_memalign == NULL) resolve();
+    ring_t *ring = enter();
+    if (ring == NULL) return real.posix_memalign(memptr, alignment, size);
+    begin(ring);
+    int err = real.posix_memalign(memptr, alignment, size);
+    push(ring, ALLOC, take_seq(), err == 0 ? *memptr : NULL, size);
+    end(ring);
+    return err;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    if (real.aligned_alloc == NULL) resolve();
+    ring_t *ring = enter();
+    if (ring == NULL) return real.aligned_alloc(alignment, size);
+    begin(ring);
+    void *ptr = real.aligned_alloc(alignment, size);
+    push(ring, ALLOC, take_seq(), ptr, size);
+    end(ring);
+    return ptr;
+}
+
+void *valloc(size_t size)
+{
+    return memalign(sysconf(_SC_PAGESIZE), size);
+}
+
+void *pvalloc(size_t size)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    return memalign(page, (size + page-1) & ~(page-1));
+}
@@ -0,0 +1,461 @@
+/*
+ * File: script.c
+ * --------------
+ * Loads allocator scripts for alloctest and the trace tools, parsing text
+ * scripts and mapping binary traces, and writes binary traces. The format
+ * of both is described in script.h.
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "keymap.h"
+#include "script.h"
+
+// the longest varint, of a 64-bit value
+#define MAX_VARINT 10
+
+// requests in a batch of a streamed script, and batches in flight: one being
+// replayed while the reader fills the other
+#define STREAM_BATCH (1 << 16)
+#define STREAM_BUFFERS 2
+
+// buffer size of the stream read from the file, well above a page
+#define STREAM_BUFSZ (1 << 20)
+
+struct stream {
+    char name[128];         // short name of the script
+    FILE *fp;
+    bool binary;            // reading a binary trace, not a text script
+    uint64_t num_ops;       // requests in a binary trace, by its header
+    long nread;             // requests read, or lines of a text script
+    keymap_t map;           // slots of the ids allocated now
+    int *free_slots;        // slots given back, to be taken again first
+    int nfree, free_capacity;
+    int num_slots;          // slots ever taken, 0 included
+    pthread_t reader;
+    bool started;           // reader is running, to be joined
+    pthread_mutex_t lock;
+    pthread_cond_t filled;  // signalled when a batch is filled or reading ends
+    pthread_cond_t emptied; // signalled when a batch is handed back or at close
+    batch_t batches[STREAM_BUFFERS];
+    int head;               // batch being replayed, or next to be
+    int nfilled;            // batches filled and not handed back
+    bool done;              // reader has stopped, at the end or on failure
+    bool failed;            // reader stopped short of the end
+    bool closing;           // stream_close wants the reader to stop
+};
+
+
+/* Function: read_line
+ * --------------------
+ * Reads one line from file and stores in buf. Skips lines that are all-white or beginning with
+ * comment char #. Increments pass-by-ref counter of number of lines read/skipped. Removes
+ * trailing newline. Returns true if did read valid line, false otherwise.
+ */
+static bool read_line(char buf[], size_t bufsz, FILE *fp, long *pnread)
+{
+    while (true) {
+        if (fgets(buf, bufsz, fp) == NULL) return false;
+        (*pnread)++;
+        if (buf[strlen(buf)-1] == '\n') buf[strlen(buf)-1] ='\0'; // remove trailing newline
+        char ch;
+        if (sscanf(buf, " %c", &ch) == 1 && ch != '#') // scan first non-white char, check not #
+            return true;
+    }
+}
+
+
+/* Function: parse_request
+ * ------------------------
+ * Parses the request on one line of a text script into req, all but its
+ * line number. Returns false if the line is not a well-formed request.
+ */
+static bool parse_request(const char *buf, request_t *req)
+{
+    char request;
+    req->op = req->size = 0;
+    int nscanned = sscanf(buf, " %c %d %zu", &request, &req->id, &req->size);
+    if (request == 'a' && nscanned == 3)
+        req->op = ALLOC;
+    else if (request == 'r' && nscanned == 3)
+        req->op = REALLOC;
+    else if (request == 'f' && nscanned == 2)
+        req->op = FREE;
+    return req->op && req->id >= 0 && req->size <= INT_MAX;
+}
+
+
+/*
+ * Fuction: parse_script
+ * ---------------------
+ * Parse a text script and store sequence of requests for later execution.
+ * The array of requests doubles as it fills, so long scripts are not copied
+ * over and over.
+ */
+static bool parse_script(FILE *fp, script_t *script)
+{
+    long lineno = 0, nallocated = 0;
+    int maxid = 0;
+    char buf[1024];
+
+    for (long i = 0; read_line(buf, sizeof(buf), fp, &lineno) ; i++) {
+        if (i == nallocated) {
+            nallocated = nallocated ? 2*nallocated : 500;
+            request_t *ops = realloc(script->ops, nallocated*sizeof(request_t));
+            if (!ops) {
+                fprintf(stderr, "Libc heap exhausted reading %s.\n", script->name);
+                return false;
+            }
+            script->ops = ops;
+        }
+        script->ops[i].lineno = lineno;
+        if (!parse_request(buf, &script->ops[i])) {
+            fprintf(stderr, "Malformed request '%s' line %ld of %s\n", buf, lineno, script->name);
+            return false;
+        }
+        if (script->ops[i].id > maxid) maxid = script->ops[i].id;
+        script->num_ops = i+1;
+    }
+    script->num_ids = maxid + 1;
+    return true;
+}
+
+
+/* Function: map_trace
+ * -------------------
+ * Maps the binary trace open on fd. Only the header is read, the requests
+ * are left to be paged in as they are replayed. The mapping stays valid
+ * after fd is closed.
+ */
+static bool map_trace(int fd, script_t *script)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(trace_header_t)) {
+        fprintf(stderr, "Truncated trace %s\n", script->name);
+        return false;
+    }
+    const unsigned char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Could not map trace %s\n", script->name);
+        return false;
+    }
+    madvise((void *)map, st.st_size, MADV_SEQUENTIAL);
+    script->trace = map + sizeof(trace_header_t);
+    script->trace_end = map + st.st_size;
+
+    // the header is read whole from the start of the mapping, which is page aligned
+    const trace_header_t *header = (const trace_header_t *)map;
+    if (header->num_ops > LONG_MAX || header->num_ids > INT_MAX ||
+        (script->trace_end > script->trace && (script->trace_end[-1] & 0x80))) {
+        fprintf(stderr, "Malformed header or last request in trace %s\n", script->name);
+        return false;
+    }
+    script->num_ops = header->num_ops;
+    script->num_ids = header->num_ids;
+    return true;
+}
+
+
+/* Function: renumber
+ * ------------------
+ * Replaces the id of req with its slot, taking a slot for an id allocated
+ * afresh and giving back the slot of an id freed. Returns false if out of
+ * memory for the table.
+ */
+static bool renumber(stream_t *stream, request_t *req)
+{
+    if (req->op == FREE) {
+        int slot;
+        if (!keymap_remove(&stream->map, req->id, &slot)) {
+            req->id = 0;
+            return true;
+        }
+        if (stream->nfree == stream->free_capacity) {
+            int capacity = stream->free_capacity ? 2*stream->free_capacity : 1024;
+            int *slots = realloc(stream->free_slots, capacity*sizeof(int));
+            if (!slots) return false;
+            stream->free_slots = slots;
+            stream->free_capacity = capacity;
+        }
+        stream->free_slots[stream->nfree++] = req->id = slot;
+        return true;
+    }
+    bool added;
+    int *slot = keymap_insert(&stream->map, req->id, &added);
+    if (!slot) return false;
+    if (added) *slot = stream->nfree ? stream->free_slots[--stream->nfree] : stream->num_slots++;
+    req->id = *slot;
+    return true;
+}
+
+/* Function: get_varint
+ * --------------------
+ * Reads a varint from fp into *value. Returns false at the end of the file.
+ */
+static bool get_varint(FILE *fp, uint64_t *value)
+{
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int byte = getc_unlocked(fp);
+        if (byte == EOF) return false;
+        *value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+/* Function: read_request
+ * ----------------------
+ * Reads the next request of a streamed script into req, with its own id.
+ * Returns false at the end of the script, with stream->failed set if the
+ * script is damaged.
+ */
+static bool read_request(stream_t *stream, request_t *req)
+{
+    if (!stream->binary) {
+        char buf[1024];
+        if (!read_line(buf, sizeof(buf), stream->fp, &stream->nread)) return false;
+        req->lineno = stream->nread;
+        if (parse_request(buf, req)) return true;
+        fprintf(stderr, "Malformed request '%s' line %ld of %s\n", buf, stream->nread, stream->name);
+        stream->failed = true;
+        return false;
+    }
+    if ((uint64_t)stream->nread == stream->num_ops) return false;
+    uint64_t word, size = 0;
+    bool ok = get_varint(stream->fp, &word);
+    req->op = word & 3;
+    req->id = word >> 2;
+    if (ok && req->op != FREE) ok = get_varint(stream->fp, &size);
+    req->size = size;
+    req->lineno = ++stream->nread;
+    if (ok && req->op && word >> 2 <= INT_MAX && size <= INT_MAX) return true;
+    fprintf(stderr, "Damaged trace at request %ld of %s\n", stream->nread, stream->name);
+    stream->failed = true;
+    return false;
+}
+
+/* Function: read_stream
+ * ---------------------
+ * The reader thread of a stream. Fills each batch as it is handed back,
+ * until the script ends or stream_close stops it.
+ */
+static void *read_stream(void *arg)
+{
+    stream_t *stream = arg;
+    bool more = true;
+    while (more) {
+        pthread_mutex_lock(&stream->lock);
+        while (stream->nfilled == STREAM_BUFFERS && !stream->closing)
+            pthread_cond_wait(&stream->emptied, &stream->lock);
+        batch_t *batch = &stream->batches[(stream->head + stream->nfilled) % STREAM_BUFFERS];
+        more = !stream->closing;
+        pthread_mutex_unlock(&stream->lock);
+
+        batch->num_ops = 0;
+        while (more && batch->num_ops < STREAM_BATCH) {
+            request_t *req = &batch->ops[batch->num_ops];
+            more = read_request(stream, req);
+            if (more && !renumber(stream, req)) {
+                fprintf(stderr, "Libc heap exhausted reading %s.\n", stream->name);
+                stream->failed = true;
+                more = false;
+            }
+            if (more) batch->num_ops++;
+        }
+        batch->num_slots = stream->num_slots;
+
+        pthread_mutex_lock(&stream->lock);
+        if (batch->num_ops > 0) stream->nfilled++;
+        stream->done = !more;
+        pthread_cond_signal(&stream->filled);
+        pthread_mutex_unlock(&stream->lock);
+    }
+    return NULL;
+}
+
+
+// Exported functions documented in script.h
+
+void script_name(const char *path, char *name, size_t len)
+{
+    const char *base = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    strncpy(name, base, len-1); // copy basename (up to limit)
+    name[len-1] = '\0';
+    char *ext = strrchr(name, '.');   // truncate file extension
+    if (ext && (strcmp(ext, ".script") == 0 || strcmp(ext, ".trace") == 0)) *ext = '\0';
+}
+
+bool load_script(const char *path, script_t *script)
+{
+    memset(script, 0, sizeof(*script));
+    script_name(path, script->name, sizeof(script->name));
+
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "Could not open script file \"%s\".\n", path);
+        return false;
+    }
+    char magic[sizeof(TRACE_MAGIC)-1];
+    bool binary = fread(magic, 1, sizeof(magic), fp) == sizeof(magic) &&
+                  memcmp(magic, TRACE_MAGIC, sizeof(magic)) == 0;
+    rewind(fp);
+    bool ok = binary ? map_trace(fileno(fp), script) : parse_script(fp, script);
+    fclose(fp);
+
+    if (ok) {
+        script->blocks = calloc(script->num_ids, sizeof(block_t));
+        if (!script->blocks && script->num_ids > 0) {
+            fprintf(stderr, "Libc heap exhausted reading %s.\n", script->name);
+            ok = false;
+        }
+    }
+    if (!ok) unload_script(script);
+    return ok;
+}
+
+void unload_script(script_t *script)
+{
+    if (script->trace) {
+        const unsigned char *map = script->trace - sizeof(trace_header_t);
+        munmap((void *)map, script->trace_end - map);
+    }
+    free(script->ops);
+    free(script->blocks);
+    script->trace = script->trace_end = NULL;
+    script->ops = NULL;
+    script->blocks = NULL;
+}
+
+stream_t *stream_open(const char *path)
+{
+    stream_t *stream = calloc(1, sizeof(stream_t));
+    if (!stream) return NULL;
+    script_name(path, stream->name, sizeof(stream->name));
+    stream->num_slots = 1;  // slot 0 stays empty for frees of ids not allocated
+    stream->fp = fopen(path, "r");
+    if (stream->fp == NULL) {
+        fprintf(stderr, "Could not open script file \"%s\".\n", path);
+        free(stream);
+        return NULL;
+    }
+    setvbuf(stream->fp, NULL, _IOFBF, STREAM_BUFSZ);
+    posix_fadvise(fileno(stream->fp), 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    trace_header_t header;
+    stream->binary = fread(&header, sizeof(header), 1, stream->fp) == 1 &&
+                     memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) == 0;
+    if (stream->binary)
+        stream->num_ops = header.num_ops;
+    else
+        rewind(stream->fp);
+
+    bool ok = true;
+    for (int i = 0; i < STREAM_BUFFERS; i++)
+        ok = ok && (stream->batches[i].ops = malloc(STREAM_BATCH*sizeof(request_t)));
+    pthread_mutex_init(&stream->lock, NULL);
+    pthread_cond_init(&stream->filled, NULL);
+    pthread_cond_init(&stream->emptied, NULL);
+    stream->started = ok && pthread_create(&stream->reader, NULL, read_stream, stream) == 0;
+    if (!stream->started) {
+        fprintf(stderr, "Could not start reading %s.\n", stream->name);
+        stream_close(stream);
+        return NULL;
+    }
+    return stream;
+}
+
+bool stream_next(stream_t *stream, batch_t *batch)
+{
+    pthread_mutex_lock(&stream->lock);
+    if (batch->ops) {   // hand back the batch replayed last
+        stream->head = (stream->head + 1) % STREAM_BUFFERS;
+        stream->nfilled--;
+        pthread_cond_signal(&stream->emptied);
+    }
+    while (stream->nfilled == 0 && !stream->done)
+        pthread_cond_wait(&stream->filled, &stream->lock);
+    bool more = stream->nfilled > 0;
+    if (more) *batch = stream->batches[stream->head];
+    pthread_mutex_unlock(&stream->lock);
+    return more;
+}
+
+bool stream_close(stream_t *stream)
+{
+    pthread_mutex_lock(&stream->lock);
+    bool finished = stream->done && stream->nfilled == 0 && !stream->failed;
+    stream->closing = true;
+    pthread_cond_signal(&stream->emptied);
+    pthread_mutex_unlock(&stream->lock);
+    if (stream->started) pthread_join(stream->reader, NULL);
+
+    fclose(stream->fp);
+    for (int i = 0; i < STREAM_BUFFERS; i++)
+        free(stream->batches[i].ops);
+    keymap_release(&stream->map);
+    free(stream->free_slots);
+    pthread_mutex_destroy(&stream->lock);
+    pthread_cond_destroy(&stream->filled);
+    pthread_cond_destroy(&stream->emptied);
+    free(stream);
+    return finished;
+}
+
+bool trace_open(trace_writer_t *writer, const char *path)
+{
+    size_t len = strlen(path);
+    writer->text = len >= 7 && strcmp(path + len - 7, ".script") == 0;
+    writer->num_ops = writer->num_ids = 0;
+    writer->fp = fopen(path, "w");
+    if (writer->fp == NULL || writer->text) return writer->fp != NULL;
+    // room for the header, written for real by trace_close
+    trace_header_t header = {.magic = {0}};
+    return fwrite(&header, sizeof(header), 1, writer->fp) == 1;
+}
+
+/* Function: write_varint
+ * ----------------------
+ * Encodes value as a varint at p. Returns the number of bytes.
+ */
+static int write_varint(unsigned char *p, uint64_t value)
+{
+    int n = 0;
+    for (; value >= 0x80; value >>= 7)
+        p[n++] = (value & 0x7f) | 0x80;
+    p[n++] = value;
+    return n;
+}
+
+bool trace_put(trace_writer_t *writer, const request_t *req)
+{
+    if (req->id < 0 || !req->op) return false;
+    if ((uint64_t)req->id >= writer->num_ids) writer->num_ids = (uint64_t)req->id + 1;
+    writer->num_ops++;
+    if (writer->text) {
+        if (req->op == FREE)
+            return fprintf(writer->fp, "f %d\n", req->id) > 0;
+        return fprintf(writer->fp, "%c %d %zu\n", req->op == ALLOC ? 'a' : 'r', req->id, req->size) > 0;
+    }
+    unsigned char buf[2*MAX_VARINT];
+    int n = write_varint(buf, (uint64_t)req->id << 2 | req->op);
+    if (req->op != FREE) n += write_varint(buf + n, req->size);
+    return fwrite_unlocked(buf, 1, n, writer->fp) == (size_t)n;
+}
+
+bool trace_close(trace_writer_t *writer)
+{
+    if (writer->text) return fclose(writer->fp) == 0;
+    trace_header_t header = {.num_ops = writer->num_ops, .num_ids = writer->num_ids};
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    bool ok = fseek(writer->fp, 0, SEEK_SET) == 0 &&
+              fwrite(&header, sizeof(header), 1, writer->fp) == 1;
+    return fclose(writer->fp) == 0 && ok;
+}
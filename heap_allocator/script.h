@@ -0,0 +1,205 @@
+/* File: script.h
+ * --------------
+ * Reading and writing scripts of allocator requests. A script comes either
+ * as a text .script file, one request per line ("a id size", "r id size" or
+ * "f id", with # comments), or as a binary .trace file written by
+ * script2trace. A text script is parsed into an array of requests up front.
+ * A binary trace is mapped as it is and its requests are decoded on the fly
+ * while they are replayed, so loading one costs nothing whatever its length.
+ *
+ * A binary trace is a trace_header_t followed by the requests. Each request
+ * is a varint of its id shifted left by two with the op in the low two bits,
+ * then for ALLOC and REALLOC a varint of the size. Varints are unsigned
+ * little-endian base 128: seven bits to a byte, with the top bit set on
+ * every byte but the last.
+ *
+ * A script too large to load is streamed instead: a reader thread parses or
+ * decodes it into batches of requests while the previous batch is replayed,
+ * and renumbers the block ids so that they stay below the peak number of
+ * blocks live at once. Memory use is then independent of the script length.
+ */
+
+#ifndef _SCRIPT_H
+#define _SCRIPT_H
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// struct for a single allocator request
+typedef struct {
+    enum {ALLOC=1, FREE, REALLOC} op;	// type of request
+    int id;		        // id for free() to use later
+    size_t size;        // num bytes for alloc/realloc request
+    long lineno;        // which line in file, or which request in a trace
+} request_t;
+
+// struct for facts about a single malloc'ed node
+typedef struct {
+    void *ptr;
+    size_t size;
+} block_t;
+
+// struct for info for one script file
+typedef struct {
+    char name[128];		// short name of script
+    request_t *ops;	    // array of requests read from a text script, else NULL
+    const unsigned char *trace;     // requests of a mapped binary trace
+    const unsigned char *trace_end; // end of the mapped trace
+    long num_ops;		// number of requests
+    int num_ids;		// number of distinct block ids
+    block_t *blocks;    // array of blocks returned by malloc when executing
+} script_t;
+
+// position of a replay in a script, see script_next
+typedef struct {
+    long index;                 // number of requests taken so far
+    const unsigned char *at;    // next request of a binary trace
+} script_pos_t;
+
+// header at the start of a binary trace
+#define TRACE_MAGIC "MYTRACE1"
+typedef struct {
+    char magic[8];      // TRACE_MAGIC, not terminated
+    uint64_t num_ops;   // number of requests that follow
+    uint64_t num_ids;   // every id is below this
+} trace_header_t;
+
+// a batch of requests of a streamed script, see stream_next
+typedef struct {
+    request_t *ops;     // requests, with ids renumbered to slots
+    long num_ops;       // number of requests in the batch
+    int num_slots;      // every slot so far is below this
+} batch_t;
+
+// a script being streamed, see stream_open
+typedef struct stream stream_t;
+
+// a script being written, see trace_open
+typedef struct {
+    FILE *fp;
+    bool text;          // writing a text script rather than a binary trace
+    uint64_t num_ops;
+    uint64_t num_ids;
+} trace_writer_t;
+
+
+/* Function: load_script
+ * ---------------------
+ * Reads the script at path into script, a binary trace if the file starts
+ * with TRACE_MAGIC and a text script otherwise. The script's name is the
+ * base of path without its extension. Returns false after printing what
+ * went wrong to stderr if the file cannot be read or is malformed.
+ */
+bool load_script(const char *path, script_t *script);
+
+/* Function: unload_script
+ * -----------------------
+ * Releases the requests and blocks of a script from load_script.
+ */
+void unload_script(script_t *script);
+
+/* Function: script_name
+ * ---------------------
+ * Stores the short name of the script at path in name, its base without the
+ * extension, truncated to len bytes with the terminator.
+ */
+void script_name(const char *path, char *name, size_t len);
+
+/* Function: stream_open
+ * ---------------------
+ * Starts streaming the script at path, text or binary, returns NULL after
+ * printing what went wrong to stderr if it cannot be opened. A reader thread
+ * reads ahead of the batches taken with stream_next. Ids are renumbered to
+ * slots as they are read: an id takes a free slot when it is first
+ * allocated (or realloc'ed) and gives it back when it is freed, so the slots
+ * only number as many as the blocks live at once. Slot 0 is never taken, a
+ * free of an id that is not allocated frees slot 0.
+ */
+stream_t *stream_open(const char *path);
+
+/* Function: stream_next
+ * ---------------------
+ * Hands the previous batch back to the reader and stores the next one in
+ * batch, waiting for it if the reader is behind. batch starts out zeroed,
+ * and its requests stay valid until the next call. Returns false at the end
+ * of the script, or where reading it failed.
+ */
+bool stream_next(stream_t *stream, batch_t *batch);
+
+/* Function: stream_close
+ * ----------------------
+ * Stops the reader and releases the stream. Returns false if the script was
+ * not read through to its end, after the reader has printed why to stderr.
+ */
+bool stream_close(stream_t *stream);
+
+/* Function: trace_open
+ * --------------------
+ * Starts writing a binary trace to path, or a text script if path ends in
+ * .script, returns false if it cannot be created. Requests are added with
+ * trace_put and the script is completed by trace_close, which fills in the
+ * header of a trace.
+ */
+bool trace_open(trace_writer_t *writer, const char *path);
+bool trace_put(trace_writer_t *writer, const request_t *req);
+bool trace_close(trace_writer_t *writer);
+
+
+/* Function: script_rewind
+ * -----------------------
+ * Sets pos to the first request of script.
+ */
+static inline void script_rewind(const script_t *script, script_pos_t *pos)
+{
+    pos->index = 0;
+    pos->at = script->trace;
+}
+
+/* Function: read_varint
+ * ---------------------
+ * Decodes the varint at *p and steps past it.
+ */
+static inline uint64_t read_varint(const unsigned char **p)
+{
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        unsigned char byte = *(*p)++;
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) break;
+    }
+    return value;
+}
+
+/* Function: script_next
+ * ---------------------
+ * Stores the request at pos in req and advances pos. Returns false at the
+ * end of the script, or at a request of a damaged trace that would run past
+ * its end or has an id or size out of range, in which case pos->index stays
+ * short of script->num_ops. load_script checks that the last byte of a trace
+ * ends a varint, so no decode reads past the mapping.
+ */
+static inline bool script_next(const script_t *script, script_pos_t *pos, request_t *req)
+{
+    if (pos->index == script->num_ops) return false;
+    if (script->ops) {
+        *req = script->ops[pos->index++];
+        return true;
+    }
+    if (pos->at >= script->trace_end) return false;
+    uint64_t word = read_varint(&pos->at);
+    req->op = word & 3;
+    req->id = word >> 2;
+    if (req->op == FREE) {
+        req->size = 0;
+    } else {
+        if (pos->at >= script->trace_end) return false;
+        req->size = read_varint(&pos->at);
+    }
+    if (!req->op || word >> 2 >= (uint64_t)script->num_ids || req->size > INT_MAX) return false;
+    req->lineno = ++pos->index;
+    return true;
+}
+
+#endif
@@ -0,0 +1,48 @@
+/*
+ * File: script2trace.c
+ * --------------------
+ * Converts an allocator script to the binary trace format of script.h,
+ * which alloctest maps and replays without parsing. Any script alloctest
+ * can read is accepted, and an output name ending in .script gives a text
+ * script, so a trace can also be turned back into text.
+ *
+ * Usage: script2trace <in.script> <out.trace>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "script.h"
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <in.script> <out.trace>\n", argv[0]);
+        return 1;
+    }
+    script_t script;
+    if (!load_script(argv[1], &script)) return 1;
+
+    trace_writer_t writer;
+    if (!trace_open(&writer, argv[2])) {
+        fprintf(stderr, "Could not create trace \"%s\".\n", argv[2]);
+        return 1;
+    }
+    script_pos_t pos;
+    request_t req;
+    bool written = true;
+    for (script_rewind(&script, &pos); written && script_next(&script, &pos, &req); )
+        written = trace_put(&writer, &req);
+    // a request that could not be written is the output's fault, a short read the input's
+    if (!written)
+        fprintf(stderr, "Could not write request %ld to \"%s\".\n", pos.index, argv[2]);
+    else if (pos.index != script.num_ops)
+        fprintf(stderr, "Damaged trace at request %ld of %s\n", pos.index + 1, script.name);
+    bool closed = trace_close(&writer);
+    if (written && !closed)
+        fprintf(stderr, "Could not write trace \"%s\".\n", argv[2]);
+    if (!written || !closed || pos.index != script.num_ops) return 1;
+    printf("%s: %ld requests, %d ids\n", argv[2], script.num_ops, script.num_ids);
+    unload_script(&script);
+    return 0;
+}
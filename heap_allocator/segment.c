@@ -7,58 +7,210 @@
 
 #include "segment.h"
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 // Place the heap at lower address, as default addresses are quite high and easily
-// mistaken for stack addresses
+// mistaken for stack addresses. Further segments go wherever the hint is free.
 #define HEAP_START_HINT (void *)0x1070000000L
 
-// Entire segment is 8 GB
-#define MAX_SEGMENT_SIZE (1L << 33)
+// static variable tracks state of the default heap segment
+static segment_t heap_segment;
 
-// static variables track state of heap segment
-static void * segment_start = NULL;
-static size_t segment_size = 0;
+segment_t *default_segment()
+{
+    return &heap_segment;
+}
 
 void *heap_segment_start()
 {
-    return segment_start;
+    return heap_segment.start;
 }
 
 size_t heap_segment_size()
 {
-    return segment_size;
+    return heap_segment.size;
+}
+
+void *init_heap_segment(size_t npages)
+{
+    return segment_init(&heap_segment, npages);
+}
+
+void *extend_heap_segment(size_t npages)
+{
+    return segment_extend(&heap_segment, npages);
 }
 
 
 // Discard any previous segment by unmapping old segment
 // Re-initialize by reserving new segment with mmap
-void *init_heap_segment(size_t npages)
+void *segment_init(segment_t *seg, size_t npages)
 {
-    if (segment_start != NULL) { // discard existing segment
-        if (munmap(segment_start, MAX_SEGMENT_SIZE) == -1) return NULL;
-        segment_start = NULL;
+    if (seg->start != NULL) { // discard existing segment
+        if (munmap(seg->start, MAX_SEGMENT_SIZE) == -1) return NULL;
+        if (seg->file_backed) close(seg->fd);
+        seg->start = NULL;
     }
     // reserve entire segment in advance
-    if ((segment_start = mmap(HEAP_START_HINT, MAX_SEGMENT_SIZE, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
-        return NULL; // allocation failure
-    segment_size = 0;
-    return extend_heap_segment(npages);
+    void *start = mmap(HEAP_START_HINT, MAX_SEGMENT_SIZE, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (start == MAP_FAILED) return NULL; // allocation failure
+    seg->start = start;
+    seg->size = 0;
+    seg->file_backed = false;
+    seg->shared = false;
+    seg->fixed = false;
+    return segment_extend(seg, npages);
+}
+
+
+// The file is mapped over the front of a reservation of the usual size,
+// so it can grow in place like any other segment
+void *segment_map_file(segment_t *seg, int fd, void *hint)
+{
+    struct stat st;
+    if (seg->start != NULL || fstat(fd, &st) == -1) return NULL;
+    if (st.st_size % PAGE_SIZE != 0 || st.st_size > MAX_SEGMENT_SIZE) return NULL;
+    void *start = mmap(hint, MAX_SEGMENT_SIZE, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+    if (start == MAP_FAILED) return NULL;
+    if (st.st_size > 0 &&
+        mmap(start, st.st_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(start, MAX_SEGMENT_SIZE);
+        return NULL;
+    }
+    seg->start = start;
+    seg->size = st.st_size;
+    seg->file_backed = true;
+    seg->fd = fd;
+    seg->shared = false;
+    seg->fixed = false;
+    return start;
+}
+
+
+// The file is mapped over the front of the new reservation, above it the
+// segment is extended from the reservation as usual. Pages mapped past the
+// end of the file would fault when touched, so a short file is refused.
+void *segment_load(segment_t *seg, int fd, size_t offset, size_t nbytes)
+{
+    struct stat st;
+    if (nbytes % PAGE_SIZE != 0 || offset % PAGE_SIZE != 0 || nbytes > MAX_SEGMENT_SIZE) return NULL;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < offset || (size_t)st.st_size - offset < nbytes) return NULL;
+    char *start = segment_init(seg, 0);
+    if (start == NULL) return NULL;
+    if (nbytes > 0 &&
+        mmap(start, nbytes, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_FIXED, fd, offset) == MAP_FAILED) {
+        segment_release(seg);
+        return NULL;
+    }
+    seg->size = nbytes;
+    return start;
+}
+
+
+// Opening up the segment only moves its end, the pages are mapped already
+// and shrinking it drops them from the object
+void *segment_map_shared(segment_t *seg, int fd, void *at)
+{
+    if (seg->start != NULL) return NULL;
+    void *start = mmap(at, MAX_SEGMENT_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_NORESERVE, fd, 0);
+    if (start == MAP_FAILED) return NULL;
+    if (at != NULL && start != at) {
+        munmap(start, MAX_SEGMENT_SIZE);
+        return NULL;
+    }
+    seg->start = start;
+    seg->size = 0;
+    seg->file_backed = false;
+    seg->shared = true;
+    seg->fixed = false;
+    return start;
+}
+
+
+void *segment_init_in(segment_t *seg, void *start, size_t nbytes)
+{
+    seg->start = start;
+    seg->size = nbytes;
+    seg->file_backed = false;
+    seg->shared = false;
+    seg->fixed = true;
+    return start;
+}
+
+
+bool segment_sync(segment_t *seg)
+{
+    if (seg->start == NULL || !seg->file_backed) return true;
+    return msync(seg->start, seg->size, MS_SYNC) == 0;
 }
 
 
 // Extend the segment and return the start address of new pages
-void *extend_heap_segment(size_t npages)
+void *segment_extend(segment_t *seg, size_t npages)
 {
-    if (segment_start == NULL) return NULL; // init has not been called?
+    if (seg->start == NULL) return NULL; // init has not been called?
 
-    void *previous_end = (char *)segment_start + segment_size;
+    void *previous_end = (char *)seg->start + seg->size;
     if (npages <= 0) return previous_end;
+    if (seg->fixed) return NULL;
     size_t increment_size = npages*PAGE_SIZE;
-    if (increment_size > MAX_SEGMENT_SIZE || (segment_size + increment_size) > MAX_SEGMENT_SIZE)
+    if (increment_size > MAX_SEGMENT_SIZE || (seg->size + increment_size) > MAX_SEGMENT_SIZE)
         return NULL;  // cannot extend beyond max size
-    segment_size += increment_size;
-    if (mprotect(previous_end, increment_size, PROT_READ|PROT_WRITE) == -1)
+    if (seg->file_backed) {
+        if (ftruncate(seg->fd, seg->size + increment_size) == -1) return NULL;
+        if (mmap(previous_end, increment_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED,
+                 seg->fd, seg->size) == MAP_FAILED) {
+            ftruncate(seg->fd, seg->size);
+            return NULL;
+        }
+    } else if (!seg->shared && mprotect(previous_end, increment_size, PROT_READ|PROT_WRITE) == -1)
         return NULL;  // allocation failure
+    seg->size += increment_size;
     return previous_end;
 }
 
+
+// Mapping fresh inaccessible pages over the top of the segment drops the
+// old pages and keeps the range reserved
+void *segment_shrink(segment_t *seg, size_t npages)
+{
+    size_t decrement_size = npages*PAGE_SIZE;
+    if (seg->start == NULL || decrement_size > seg->size) return NULL;
+    char *new_end = (char *)seg->start + seg->size - decrement_size;
+    if (npages == 0) return new_end;
+    if (seg->fixed) return NULL;
+    if (seg->shared) {
+        if (madvise(new_end, decrement_size, MADV_REMOVE) == -1) return NULL;
+    } else if (mmap(new_end, decrement_size, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED, -1, 0) == MAP_FAILED)
+        return NULL;
+    seg->size -= decrement_size;
+    if (seg->file_backed) ftruncate(seg->fd, seg->size);
+    return new_end;
+}
+
+
+void segment_release(segment_t *seg)
+{
+    if (seg->start != NULL && !seg->fixed) munmap(seg->start, MAX_SEGMENT_SIZE);
+    if (seg->start != NULL && seg->file_backed) close(seg->fd);
+    seg->start = NULL;
+    seg->size = 0;
+    seg->file_backed = false;
+    seg->shared = false;
+    seg->fixed = false;
+}
+
+
+// Side segments are mapped anywhere, the kernel only backs the pages
+// that are actually touched
+void *reserve_side_segment(size_t nbytes)
+{
+    void *side = mmap(NULL, nbytes, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+    return side == MAP_FAILED ? NULL : side;
+}
+
+void release_side_segment(void *side, size_t nbytes)
+{
+    if (side != NULL) munmap(side, nbytes);
+}
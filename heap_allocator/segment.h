@@ -11,6 +11,7 @@
 #ifndef _SEGMENT_H_
 #define _SEGMENT_H_
 #include <stddef.h> // for size_t
+#include <stdbool.h> // for bool
 
 /* Constants
  * ---------
@@ -20,6 +21,9 @@
  */
 #define PAGE_SIZE 4096
 
+/* MAX_SEGMENT_SIZE is the upper bound on the heap segment, 8 GB. */
+#define MAX_SEGMENT_SIZE (1L << 33)
+
 
 /* Function: init_heap_segment
  * ---------------------------
@@ -60,4 +64,115 @@ void *heap_segment_start(void);
 size_t heap_segment_size(void);
 
 
+/* Type: segment_t
+ * ---------------
+ * A segment reservation of its own, for clients that need more than one
+ * heap. The functions above all work on a single default segment, the
+ * ones below do the same for the segment they are given. A segment_t
+ * must be zeroed before its first segment_init.
+ */
+typedef struct {
+    void *start;  // base address of the reservation, NULL if none
+    size_t size;  // bytes opened up so far, a multiple of PAGE_SIZE
+    bool file_backed; // the pages opened up are those of file fd
+    int fd;
+    bool shared; // the whole reservation maps a shared memory object
+    bool fixed; // memory of the caller's, that cannot grow or shrink
+} segment_t;
+
+
+/* Functions: segment_init, segment_extend, segment_release
+ * --------------------------------------------------------
+ * segment_init and segment_extend behave as init_heap_segment and
+ * extend_heap_segment, for the segment seg. segment_release unmaps the
+ * whole reservation of seg and leaves it empty.
+ */
+void *segment_init(segment_t *seg, size_t npages);
+void *segment_extend(segment_t *seg, size_t npages);
+void segment_release(segment_t *seg);
+
+
+/* Function: segment_shrink
+ * ------------------------
+ * Gives the last npages of seg back to the OS. They stay reserved and
+ * can be opened up again by segment_extend. Returns the new end of the
+ * segment, or NULL if it cannot be shrunk by that much.
+ */
+void *segment_shrink(segment_t *seg, size_t npages);
+
+
+/* Function: segment_map_file
+ * ----------------------------
+ * Sets up seg, which must be empty, as a shared mapping of the open file
+ * fd, whose size must be a multiple of PAGE_SIZE. The whole file is opened
+ * up, at hint if that range is free, and changes to the pages go to the
+ * file. Extending seg grows the file and shrinking it truncates the file.
+ * On success seg owns fd and closes it when released. Returns the base
+ * address of seg, or NULL if the file cannot be mapped.
+ */
+void *segment_map_file(segment_t *seg, int fd, void *hint);
+
+
+/* Function: segment_map_shared
+ * ------------------------------
+ * Sets up seg, which must be empty, as a shared mapping of the open shared
+ * memory object fd, which must be MAX_SEGMENT_SIZE bytes. The whole object
+ * is mapped, so that the segment opened up by any process that maps it is
+ * open in all of them, and seg starts with no pages opened up. If at is
+ * not NULL the object must map there. Returns the base address of seg, or
+ * NULL if the object cannot be mapped. fd can be closed afterwards.
+ */
+void *segment_map_shared(segment_t *seg, int fd, void *at);
+
+
+/* Function: segment_init_in
+ * ---------------------------
+ * Sets up seg, which must be empty, over the nbytes at start that the
+ * caller already owns, making no system calls. All of it is open from the
+ * start, seg cannot be extended or shrunk, and releasing seg leaves the
+ * memory alone. Returns start.
+ */
+void *segment_init_in(segment_t *seg, void *start, size_t nbytes);
+
+
+/* Function: segment_load
+ * -----------------------
+ * Discards the current contents of seg, as segment_init does, and opens it
+ * up again over nbytes of the open file fd from offset on, which must both
+ * be multiples of PAGE_SIZE. The pages are a private copy of the file,
+ * read in as they are touched, and writing to them leaves the file as it
+ * was. Returns the base address of seg, or NULL if the file is too short
+ * or cannot be mapped. A file too short leaves seg as it was, a failed
+ * mapping leaves it empty.
+ */
+void *segment_load(segment_t *seg, int fd, size_t offset, size_t nbytes);
+
+
+/* Function: segment_sync
+ * ----------------------
+ * Writes the pages of a file-backed seg out to its file and waits for
+ * them to get there. Returns false if they could not be written.
+ */
+bool segment_sync(segment_t *seg);
+
+
+/* Function: default_segment
+ * -------------------------
+ * Returns the segment that init_heap_segment and the others work on.
+ */
+segment_t *default_segment(void);
+
+
+/* Function: reserve_side_segment
+ * ------------------------------
+ * Reserves nbytes of zero-filled memory outside of the heap segment, for
+ * allocator bookkeeping that should not live inside the heap itself. The
+ * reservation lasts until it is given back with release_side_segment; pages
+ * only take up real memory once they are touched. Returns NULL if the memory
+ * is not available.
+ */
+void *reserve_side_segment(size_t nbytes);
+void release_side_segment(void *side, size_t nbytes);
+
+
 #endif
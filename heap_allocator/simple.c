@@ -7,19 +7,24 @@
 #include <stdlib.h>
 #include <string.h>
 #include "allocator.h"
+#include "arena.h"
+#include "pool.h"
 
 
 typedef struct _cell {
    char *string;
    struct _cell *next;
 } cell;
+
+// All of the cells come from this pool
+static mypool_t *cell_pool;
     
 	
 // Add a new cell to front of list, data for new cell is
 // string s. head is passed by ref to change to point to new cell
 static void push(cell **head, char *s)
 {
-   cell *c = (cell *)mymalloc(sizeof(cell));
+   cell *c = (cell *)mypool_alloc(cell_pool);
    c->next = *head;
    c->string = mymalloc(strlen(s)+1);
    strcpy(c->string, s);
@@ -41,7 +46,7 @@ static void free_list(cell *head)
    while (head != NULL) {
       cell *next = head->next;
       myfree(head->string);
-      myfree(head);
+      mypool_free(cell_pool, head);
       head = next;
    }
 }
@@ -59,16 +64,28 @@ static void concat_neighbors(cell *head)
       cur->string[len] = '-';
       strcpy(cur->string+len+1, next->string);
       myfree(next->string);
-      myfree(next);
+      mypool_free(cell_pool, next);
    }
 }
 
+// Add a new cell to front of list with the cell and its string
+// taken from arena, so neither is ever freed on its own
+static void push_arena(arena_t *arena, cell **head, char *s)
+{
+   cell *c = (cell *)arena_alloc(arena, sizeof(cell));
+   c->next = *head;
+   c->string = arena_alloc(arena, strlen(s)+1);
+   strcpy(c->string, s);
+   *head = c;
+}
+
 // Does some silly linked list creation and manipulation
 // in order to exercise the heap allocator routines.
 int main(int argc, char *argv[])
 {
    cell *list = NULL;
    myinit();
+   cell_pool = mypool_create(sizeof(cell), 0);
    for (int i = 0; i < 200; i++) {
       char num[10];
       sprintf(num, "%d", i);
@@ -79,6 +96,20 @@ int main(int argc, char *argv[])
       concat_neighbors(list);
    print_list(list);
    free_list(list);
-   return 0;
+   mypool_destroy(cell_pool);
+
+   // the same list again in an arena, dropped all at once
+   arena_t *arena = arena_create(0);
+   for (int round = 0; round < 2; round++) {
+      list = NULL;
+      for (int i = 0; i < 200; i++) {
+         char num[10];
+         sprintf(num, "%d", i);
+         push_arena(arena, &list, num);
+      }
+      arena_reset(arena);
+   }
+   arena_release(arena);
+   return validate_heap() ? 0 : 1;
 }
 
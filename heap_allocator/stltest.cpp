@@ -0,0 +1,93 @@
+/*
+ * File: stltest.cpp
+ * -----------------
+ * Exercises the C++ adapters in allocator.hpp, with operator new replaced.
+ * The container below is filled during static initialization, before any
+ * call to operator new and without the program calling myinit, so its
+ * allocator has to set up the default heap on its own.
+ */
+#define MYALLOC_REPLACE_NEW
+#include <cstdio>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <string>
+#include <vector>
+#include "allocator.hpp"
+
+static std::vector<int, myalloc::allocator<int>> early = [] {
+    std::vector<int, myalloc::allocator<int>> v;
+    for (int i = 0; i < 1000; i++) v.push_back(i);
+    return v;
+}();
+
+static int failures = 0;
+static int handler_calls = 0;
+
+// gives up on the second call, as a handler with nothing left to free does
+static void out_of_memory()
+{
+    if (++handler_calls == 2) std::set_new_handler(nullptr);
+}
+
+static void check(bool ok, const char *what)
+{
+    if (!ok) {
+        std::printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+int main()
+{
+    bool intact = true;
+    for (int i = 0; i < 1000; i++) intact = intact && early[i] == i;
+    check(early.size() == 1000 && intact, "container filled before main");
+    check(validate_heap(), "heap valid after static initialization");
+
+    // the heap is already set up, so later users must not start it over
+    check(myinit_once(), "myinit_once on a ready heap");
+    check(early[999] == 999, "container kept by myinit_once");
+
+    std::vector<std::unique_ptr<std::string>> strings;
+    for (int i = 0; i < 500; i++) strings.push_back(std::make_unique<std::string>(100 + i, 'x'));
+    for (std::size_t i = 0; i < strings.size(); i += 2) strings[i].reset();
+    check(validate_heap(), "heap valid after operator new and delete");
+
+    struct alignas(64) wide { char bytes[64]; };
+    wide *w = new wide[3];
+    check(reinterpret_cast<std::uintptr_t>(w) % 64 == 0, "aligned operator new");
+    delete[] w;
+
+    std::set_new_handler(out_of_memory);
+    bool thrown = false;
+    try {
+        char *huge = new char[std::size_t(1) << 40];
+        delete[] huge;
+    } catch (const std::bad_alloc &) {
+        thrown = true;
+    }
+    check(thrown && handler_calls == 2, "new handler called until it gives up");
+
+    myalloc::heap_resource resource;
+    check(resource.heap() == myheap_default(), "heap_resource on the default heap");
+    std::pmr::vector<long> pmr(&resource);
+    for (long i = 0; i < 2000; i++) pmr.push_back(i);
+    check(pmr[1999] == 1999, "pmr container on the default heap");
+
+    arena_t *arena = arena_create(1 << 16);
+    check(arena != nullptr, "arena created");
+    if (arena != nullptr) {
+        // the container goes out of scope before its arena is released
+        myalloc::arena_resource arena_res(arena);
+        std::pmr::vector<double> scratch(&arena_res);
+        for (int i = 0; i < 500; i++) scratch.push_back(i);
+        check(scratch[499] == 499, "pmr container in an arena");
+    }
+    if (arena != nullptr) arena_release(arena);
+
+    check(validate_heap(), "heap valid at the end");
+    std::printf("%s\n", failures == 0 ? "All tests passed" : "Some tests failed");
+    return failures == 0 ? 0 : 1;
+}
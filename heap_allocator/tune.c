@@ -0,0 +1,328 @@
+/*
+ * File: tune.c
+ * ------------
+ * Searches the policy parameters of allocator.c for the configurations
+ * that trade off utilization against throughput best on a set of scripts.
+ * Each candidate configuration is built as the alloctest-tune variant
+ * through the Makefile and run through alloctest on the given scripts.
+ * Configurations where any script fails are dropped. The Pareto front
+ * of (utilization, Kreq/sec) is reported, and the best configuration on
+ * the front is written out as a policy header that allocator.c picks up
+ * with -DPOLICY_HEADER (make alloctest-tuned builds it).
+ *
+ * Must be run from the directory holding the Makefile.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_VALUES 8
+#define MAX_TRIALS 500
+#define DEFAULT_TRIALS 30
+#define DEFAULT_OUTPUT "allocator_policy.h"
+
+// One policy parameter of allocator.c and the values tried for it.
+// Features are #ifdef switches, on when the value is 1.
+typedef struct {
+    const char *name;
+    bool feature;
+    int nvalues;
+    int values[MAX_VALUES];
+    int deflt;          // index of the allocator's own default
+} knob_t;
+
+static const knob_t knobs[] = {
+    {"NUM_BUCKETS",       false, 6, {8, 12, 15, 20, 28, 40}, 2},
+    {"BUCKET_BASE_BITS",  false, 3, {3, 4, 5}, 0},
+    {"BUCKET_SPLIT_BITS", false, 3, {0, 1, 2}, 0},
+    {"MIN_PAYLOAD",       false, 4, {16, 24, 32, 48}, 0},
+    {"EXTEND_PAGES",      false, 4, {1, 2, 8, 32}, 0},
+    {"SPLIT_MIN",         false, 4, {8, 24, 40, 72}, 0},
+    {"SORTED_LISTS",      false, 2, {0, 1}, 1},
+    {"BEST_FIT",          false, 2, {0, 1}, 1},
+    {"SPLIT_HIGH",        true,  2, {0, 1}, 0},
+    {"FREE_INDEX",        true,  2, {0, 1}, 0},
+    {"QUICK_LISTS",       true,  2, {0, 1}, 0},
+};
+#define NUM_KNOBS (sizeof(knobs)/sizeof(knobs[0]))
+
+// one configuration tried and how it did
+typedef struct {
+    int choice[NUM_KNOBS];  // index into each knob's values
+    bool valid;             // built and ran every script correctly
+    double utilization;     // aggregate utilization, 0 to 1
+    int tput;               // aggregate Kreq/sec
+    bool pareto;            // not beaten on both counts by another trial
+} trial_t;
+
+static void random_trial(trial_t *trial);
+static bool same_config(const trial_t *a, const trial_t *b);
+static void config_flags(const trial_t *trial, char *buf, size_t bufsz);
+static void run_trial(trial_t *trial, const char *path, bool perf_only);
+static void mark_pareto(trial_t trials[], int n);
+static int pick_best(trial_t trials[], int n, double weight);
+static void print_trials(trial_t trials[], int n, int best);
+static void write_header(const trial_t *trial, const char *outfile, const char *path);
+static void usage();
+static void fatal_error(char *format, ...);
+
+
+int main(int argc, char *argv[])
+{
+    char *path = NULL, *outfile = DEFAULT_OUTPUT;
+    int ntrials = DEFAULT_TRIALS;
+    unsigned int seed = 107;
+    double weight = 0.5;
+    bool perf_only = false;
+    int c;
+
+    while ((c = getopt(argc, argv, "f:n:o:s:w:p")) != EOF) {
+        switch (c) {
+            case 'f': path = optarg; break;
+            case 'n': ntrials = atoi(optarg); break;
+            case 'o': outfile = optarg; break;
+            case 's': seed = strtoul(optarg, NULL, 10); break;
+            case 'w': weight = atof(optarg); break;
+            case 'p': perf_only = true; break;
+            default: usage();
+        }
+    }
+    if (optind < argc || path == NULL || ntrials < 1 || ntrials > MAX_TRIALS || weight < 0 || weight > 1)
+        usage();
+    if (access("Makefile", R_OK) != 0)
+        fatal_error("No Makefile here, run tune from the allocator directory.\n");
+    srandom(seed);
+    setvbuf(stdout, NULL, _IONBF, 0);
+
+    // first trial is the allocator's defaults, the rest are distinct random picks
+    trial_t trials[ntrials];
+    for (int i = 0; i < ntrials; i++) {
+        bool repeated;
+        int attempts = 0;
+        do {
+            if (i == 0)
+                for (int k = 0; k < NUM_KNOBS; k++) trials[i].choice[k] = knobs[k].deflt;
+            else
+                random_trial(&trials[i]);
+            repeated = false;
+            for (int j = 0; j < i && !repeated; j++)
+                repeated = same_config(&trials[i], &trials[j]);
+        } while (repeated && ++attempts < 1000);
+        if (repeated) { ntrials = i; break; }  // search space exhausted
+        printf("Trial %d of %d...", i + 1, ntrials);
+        run_trial(&trials[i], path, perf_only);
+        if (trials[i].valid)
+            printf(" %.0f%% utilization, %d Kreq/sec.\n", trials[i].utilization*100, trials[i].tput);
+        else
+            printf(" failed.\n");
+    }
+
+    mark_pareto(trials, ntrials);
+    int best = pick_best(trials, ntrials, weight);
+    print_trials(trials, ntrials, best);
+    if (best < 0)
+        fatal_error("No configuration ran all scripts correctly.\n");
+    write_header(&trials[best], outfile, path);
+    printf("Wrote configuration %d to %s, build it with: make alloctest-tuned\n", best + 1, outfile);
+    unlink("alloctest-tune");
+    return 0;
+}
+
+
+/* Function: random_trial
+ * ----------------------
+ * Picks a value for every knob uniformly at random.
+ */
+static void random_trial(trial_t *trial)
+{
+    for (int k = 0; k < NUM_KNOBS; k++)
+        trial->choice[k] = random() % knobs[k].nvalues;
+}
+
+static bool same_config(const trial_t *a, const trial_t *b)
+{
+    return memcmp(a->choice, b->choice, sizeof(a->choice)) == 0;
+}
+
+
+/* Function: config_flags
+ * ----------------------
+ * Writes the compiler flags that select the configuration of trial.
+ */
+static void config_flags(const trial_t *trial, char *buf, size_t bufsz)
+{
+    buf[0] = '\0';
+    for (int k = 0; k < NUM_KNOBS; k++) {
+        int value = knobs[k].values[trial->choice[k]];
+        size_t len = strlen(buf);
+        if (knobs[k].feature && value)
+            snprintf(buf + len, bufsz - len, " -D%s", knobs[k].name);
+        else if (!knobs[k].feature)
+            snprintf(buf + len, bufsz - len, " -D%s=%d", knobs[k].name, value);
+    }
+}
+
+
+/* Function: run_trial
+ * -------------------
+ * Builds the alloctest-tune variant for the configuration of trial and runs
+ * it on the scripts at path, reading the results off the aggregate line of
+ * the alloctest table. The trial is valid only if every script passed.
+ */
+static void run_trial(trial_t *trial, const char *path, bool perf_only)
+{
+    char flags[512], cmd[1024 + PATH_MAX];
+    config_flags(trial, flags, sizeof(flags));
+    trial->valid = false;
+
+    // the variant object only depends on its sources, force it to be rebuilt
+    unlink("allocator-tune.o");
+    snprintf(cmd, sizeof(cmd), "make -s alloctest-tune 'VARIANT_tune=%s' > /dev/null", flags);
+    if (system(cmd) != 0)
+        return;
+    snprintf(cmd, sizeof(cmd), "./alloctest-tune %s -f '%s'", perf_only ? "-p" : "", path);
+    FILE *fp = popen(cmd, "r");
+    if (fp == NULL)
+        fatal_error("Could not run \"%s\": %s\n", cmd, strerror(errno));
+    char line[1024];
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        int passed, total, requests, tput;
+        double percent, secs;
+        if (sscanf(line, " Aggregate %d of %d %lf%% %d %lf %d", &passed, &total, &percent,
+                   &requests, &secs, &tput) == 6 && passed == total) {
+            trial->valid = true;
+            trial->utilization = percent/100;
+            trial->tput = tput;
+        }
+    }
+    if (pclose(fp) != 0)
+        trial->valid = false;
+}
+
+
+/* Function: mark_pareto
+ * ---------------------
+ * Marks the valid trials that no other valid trial beats on both
+ * utilization and throughput.
+ */
+static void mark_pareto(trial_t trials[], int n)
+{
+    for (int i = 0; i < n; i++) {
+        trials[i].pareto = trials[i].valid;
+        for (int j = 0; j < n && trials[i].pareto; j++) {
+            if (j == i || !trials[j].valid) continue;
+            if (trials[j].utilization >= trials[i].utilization && trials[j].tput >= trials[i].tput &&
+                (trials[j].utilization > trials[i].utilization || trials[j].tput > trials[i].tput))
+                trials[i].pareto = false;
+        }
+    }
+}
+
+
+/* Function: pick_best
+ * -------------------
+ * Among the trials on the Pareto front, picks the one with the highest
+ * score, where the score weighs utilization by weight and throughput by
+ * 1 - weight, each relative to the best seen. Returns -1 if none is valid.
+ */
+static int pick_best(trial_t trials[], int n, double weight)
+{
+    double top_util = 0, top_tput = 0, best_score = -1;
+    int best = -1;
+    for (int i = 0; i < n; i++) {
+        if (!trials[i].valid) continue;
+        if (trials[i].utilization > top_util) top_util = trials[i].utilization;
+        if (trials[i].tput > top_tput) top_tput = trials[i].tput;
+    }
+    for (int i = 0; i < n; i++) {
+        if (!trials[i].pareto) continue;
+        double score = weight*trials[i].utilization/top_util + (1 - weight)*trials[i].tput/top_tput;
+        if (score > best_score) {
+            best_score = score;
+            best = i;
+        }
+    }
+    return best;
+}
+
+
+/* Function: print_trials
+ * ----------------------
+ * Prints the configurations on the Pareto front, best marked with a *.
+ */
+static void print_trials(trial_t trials[], int n, int best)
+{
+    char flags[512];
+    printf("\n trial  utilization    Kreq/sec   configuration (Pareto front)\n");
+    printf("-------------------------------------------------------------------------------\n");
+    for (int i = 0; i < n; i++) {
+        if (!trials[i].pareto) continue;
+        config_flags(&trials[i], flags, sizeof(flags));
+        printf("%c%5d %11.0f%% %11d  %s\n", i == best ? '*' : ' ', i + 1,
+               trials[i].utilization*100, trials[i].tput, flags);
+    }
+    printf("\n");
+}
+
+
+/* Function: write_header
+ * ----------------------
+ * Writes the configuration of trial as a header of #defines.
+ */
+static void write_header(const trial_t *trial, const char *outfile, const char *path)
+{
+    FILE *fp = fopen(outfile, "w");
+    if (fp == NULL)
+        fatal_error("Could not write \"%s\": %s\n", outfile, strerror(errno));
+    fprintf(fp, "/* File: %s\n * ", outfile);
+    for (size_t i = 0; i < strlen("File: ") + strlen(outfile); i++)
+        fputc('-', fp);
+    fprintf(fp, "\n");
+    fprintf(fp, " * Allocator policy chosen by tune for the scripts in %s:\n", path);
+    fprintf(fp, " * %.0f%% utilization, %d Kreq/sec. Build allocator.c with\n", trial->utilization*100, trial->tput);
+    fprintf(fp, " * -DPOLICY_HEADER='\"%s\"' to use it.\n */\n", outfile);
+    fprintf(fp, "#ifndef _ALLOCATOR_POLICY_H\n#define _ALLOCATOR_POLICY_H\n\n");
+    for (int k = 0; k < NUM_KNOBS; k++) {
+        int value = knobs[k].values[trial->choice[k]];
+        if (knobs[k].feature && value)
+            fprintf(fp, "#define %s\n", knobs[k].name);
+        else if (!knobs[k].feature)
+            fprintf(fp, "#define %s %d\n", knobs[k].name, value);
+    }
+    fprintf(fp, "\n#endif\n");
+    fclose(fp);
+}
+
+
+/* Function: fatal_error
+ * ---------------------
+ * Reports an error and exits.
+ */
+static void fatal_error(char *format, ...)
+{
+    fprintf(stdout, "\nFATAL ERROR: ");
+    va_list args;
+    va_start(args, format);
+    vfprintf(stdout, format, args);
+    va_end(args);
+    exit(107);
+}
+
+static void usage()
+{
+   fprintf(stderr, "Usage: %s -f <file-or-dir> [-n trials] [-s seed] [-w weight] [-o header] [-p]\n", program_invocation_short_name);
+   fprintf(stderr, "\t-f <file-or-dir>  Tune on <file> as script or on all script files in <dir>.\n");
+   fprintf(stderr, "\t-n <trials>       Number of configurations to try (default %d, at most %d).\n", DEFAULT_TRIALS, MAX_TRIALS);
+   fprintf(stderr, "\t-s <seed>         Seed for picking configurations.\n");
+   fprintf(stderr, "\t-w <weight>       Weight of utilization against throughput in [0,1] (default 0.5).\n");
+   fprintf(stderr, "\t-o <header>       Where to write the chosen configuration (default %s).\n", DEFAULT_OUTPUT);
+   fprintf(stderr, "\t-p                Skip the correctness checks, only run the performance tests.\n");
+   exit(107);
+}